@@ -0,0 +1,111 @@
+// Cold-start benchmark for task_optimizer.
+//
+// Runs "task_optimizer --startup-probe" repeatedly and times each run from
+// fork (just before execve) to exit. The probe takes the daemon's real
+// startup path (exec, static init, rules and snapshot loading, the first
+// full /proc scan and rule matching) as a dry run, then exits, so the
+// figure is time to first tuning decision without changing the system.
+// Peak RSS comes from wait4 and includes the first process table. Exits 1
+// when the median time or the peak RSS is over budget.
+//
+// Usage: startup_bench BINARY [RUNS] [BUDGET_US] [BUDGET_RSS_KB]
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+long long nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct Sample {
+    long long startupUs = 0;
+    long maxRssKb = 0;
+};
+
+// One run; returns false unless the probe ran and exited cleanly
+bool runOnce(const char* binary, Sample& sample) {
+    const long long start = nowNs();
+    const pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        // Dry-run output would otherwise be part of the measurement
+        int devNull = open("/dev/null", O_WRONLY);
+        if (devNull >= 0) {
+            dup2(devNull, STDOUT_FILENO);
+            dup2(devNull, STDERR_FILENO);
+        }
+        execl(binary, binary, "--startup-probe", static_cast<char*>(nullptr));
+        _exit(127);
+    }
+
+    int status = 0;
+    rusage usage{};
+    if (wait4(pid, &status, 0, &usage) != pid) return false;
+    sample.startupUs = (nowNs() - start) / 1000;
+    sample.maxRssKb = usage.ru_maxrss;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s BINARY [RUNS] [BUDGET_US] [BUDGET_RSS_KB]\n", argv[0]);
+        return 2;
+    }
+    const char* binary = argv[1];
+    const int runs = argc > 2 ? std::max(1, std::atoi(argv[2])) : 100;
+    const long long budgetUs = argc > 3 ? std::atoll(argv[3]) : 0;
+    const long budgetKb = argc > 4 ? std::atol(argv[4]) : 0;
+
+    // One untimed run pulls the binary and its libraries into the page cache
+    Sample warmup;
+    if (!runOnce(binary, warmup)) {
+        std::fprintf(stderr, "Cannot run %s --startup-probe\n", binary);
+        return 1;
+    }
+
+    std::vector<long long> times;
+    long maxRssKb = 0;
+    for (int i = 0; i < runs; ++i) {
+        Sample sample;
+        if (!runOnce(binary, sample)) {
+            std::fprintf(stderr, "Run %d failed\n", i);
+            return 1;
+        }
+        times.push_back(sample.startupUs);
+        maxRssKb = std::max(maxRssKb, sample.maxRssKb);
+    }
+    std::sort(times.begin(), times.end());
+    const long long median = times[times.size() / 2];
+    const long long p95 = times[std::min(times.size() - 1, times.size() * 95 / 100)];
+
+    std::printf("exec to first full scan: min %lld us, median %lld us, p95 %lld us (%d runs)\n",
+                times.front(), median, p95, runs);
+    std::printf("peak RSS: %ld KiB\n", maxRssKb);
+
+    bool ok = true;
+    if (budgetUs > 0) {
+        const bool within = median <= budgetUs;
+        std::printf("time budget %lld us: %s\n", budgetUs, within ? "ok" : "EXCEEDED");
+        ok &= within;
+    }
+    if (budgetKb > 0) {
+        const bool within = maxRssKb <= budgetKb;
+        std::printf("RSS budget %ld KiB: %s\n", budgetKb, within ? "ok" : "EXCEEDED");
+        ok &= within;
+    }
+    return ok ? 0 : 1;
+}
@@ -32,6 +32,7 @@ build_abi() {
         -DCMAKE_TOOLCHAIN_FILE="$ANDROID_NDK/build/cmake/android.toolchain.cmake" \
         -DANDROID_ABI="$ABI" \
         -DANDROID_PLATFORM="$ANDROID_PLATFORM" \
+        -DANDROID_STL=c++_static \
         -DCMAKE_BUILD_TYPE="$BUILD_TYPE" \
         ../..
 
@@ -3,15 +3,9 @@
 # Module root dir
 MODDIR="${0%/*}"
 
-wait_until_login() {
-  until [ "$(getprop sys.boot_completed)" -eq 1 ]; do
-    sleep 1
-  done
-}
-wait_until_login
-sleep 30
-
-mkdir -p "$MODPATH/logs" &&
-"$MODDIR/bin/task_optimizer" 2>/dev/null
+# Start right away: the optimizer waits for its targets itself and tunes
+# each one as soon as it execs, instead of after boot completes
+mkdir -p "$MODDIR/logs" &&
+"$MODDIR/bin/task_optimizer" 2>/dev/null &
 
 exit 0
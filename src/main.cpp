@@ -1,27 +1,60 @@
 #include <algorithm>
 #include <array>
 #include <atomic>
+#include <cctype>
 #include <chrono>
-#include <filesystem>
-#include <fstream>
-#include <iomanip>
-#include <iostream>
+#include <climits>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <memory>
 #include <mutex>
 #include <optional>
-#include <regex>
+#include <poll.h>
 #include <sched.h>
 #include <cstring>
-#include <sstream>
+#include <ctime>
 #include <string>
 #include <string_view>
+#include <sys/mman.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <thread>
 #include <unistd.h>
 #include <unordered_map>
 #include <vector>
 
-namespace fs = std::filesystem;
+#if defined(TASK_OPTIMIZER_IO_URING) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+// Direct descriptors (file_index) need 5.15+ uapi headers
+#if defined(__NR_io_uring_setup) && defined(IORING_FILE_INDEX_ALLOC)
+#define TASK_OPTIMIZER_HAS_IO_URING 1
+#endif
+#endif
+
+// Bionic only; elsewhere boot is never reported complete
+#if __has_include(<sys/system_properties.h>)
+#include <sys/system_properties.h>
+#define TASK_OPTIMIZER_HAS_PROPERTIES 1
+#endif
+
+// process_madvise(2) advice values missing from older libc headers
+#ifndef MADV_COLD
+#define MADV_COLD 20
+#endif
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
 
 namespace config {
     constexpr const char* LOG_DIR = "/data/adb/modules/task_optimizer/logs/";
@@ -42,41 +75,309 @@ namespace config {
         "f2fs_gc", "wlan_logging_th"
     };
 
+    // Hard IRQs (action names in /proc/interrupts) of touch, GPU and display
+    // steered onto the perf cores, next to the RT threads they wake. Their
+    // threaded handlers, irq/<n>-<name>, match the same patterns.
+    constexpr std::array<std::string_view, 5> IRQ_TASKS = {
+        "fts_ts", "NVT-ts", "kgsl_3d0_irq", "MDSS", "dsi_ctrl"
+    };
+    constexpr int IRQ_POLL_MS = 2000; // drivers register IRQs late in boot
+
+    // Unbound workqueues whose names match a rule take its nice and cores
+    constexpr int WORKQUEUE_POLL_MS = 2000; // modules add workqueues as they load
+
+    // Capacity (0-1024) background work must be able to reach on the
+    // energy-selected cores
+    constexpr int LOW_PRIO_MIN_CAPACITY = 160;
+
+    // I/O priority levels (0 highest, 7 lowest) of the built-in groups:
+    // best-effort for high-priority tasks, the lowest real-time level for
+    // the block-layer workers they wait on. Display RT tasks get BE 0 and
+    // background tasks the idle class.
+    constexpr int HIGH_PRIO_IO_LEVEL = 1;
+    constexpr std::array<std::string_view, 2> IO_RT_TASKS = {"kblockd", "writeback"};
+    constexpr int IO_RT_LEVEL = 7;
+
     constexpr int MAX_RETRIES = 3;
     constexpr int RETRY_DELAY_MS = 50;
+
+    // Interval between incremental rescans of /proc
+    constexpr int RESCAN_INTERVAL_MS = 10000;
+
+    // Use process-wide primitives (process group, cpuset) once a newly
+    // matched process has at least this many threads
+    constexpr size_t COALESCE_MIN_THREADS = 2;
+    constexpr bool COALESCE_CPUSET = true;
+    // A cpuset that could not be created is tried again after this long
+    constexpr int CPUSET_RETRY_MS = 30000;
+
+    // Early start: react to exec/comm events until every rule has matched,
+    // sys.boot_completed is set or the deadline passes
+    constexpr int EARLY_START_DEADLINE_MS = 120000;
+    constexpr int EARLY_START_RESCAN_MS = 2000;
+    constexpr int EVENT_DEBOUNCE_MS = 20;
+
+    // Thermal demotion of boosted (RT / perf-pinned) tasks, millidegrees C.
+    // Demote at HOT or while CPU cooling devices throttle, restore below COOL.
+    constexpr int THERMAL_HOT_MC = 85000;
+    constexpr int THERMAL_COOL_MC = 75000;
+    constexpr int THERMAL_POLL_MS = 2000;
+    constexpr int THERMAL_DEMOTED_NICE = -10; // for RT tasks relaxed to CFS
+
+    // Tracing: create TRACE_FLAG to emit trace_marker events; write "json"
+    // into it to also record a Chrome/Perfetto JSON trace to TRACE_JSON
+    constexpr const char* TRACE_FLAG = "/data/adb/modules/task_optimizer/trace";
+    constexpr const char* TRACE_JSON = "/data/adb/modules/task_optimizer/logs/trace.json";
+
+    // Scheduling state of each thread before it was first tuned this boot
+    constexpr const char* SNAPSHOT_FILE = "/data/adb/modules/task_optimizer/state.bin";
+
+    // Daemon control: rules file used instead of the built-in lists when
+    // present, and the Unix socket for status queries and commands
+    constexpr const char* RULES_FILE = "/data/adb/modules/task_optimizer/rules.conf";
+    constexpr const char* CONTROL_SOCKET = "/data/adb/modules/task_optimizer/control.sock";
+    constexpr int CONTROL_SNAPSHOT_MS = 1000; // max age of a read-only query reply
+
+    // Setter budget: per-rule token bucket plus a global cap per window.
+    // Threads over budget are deferred and retried every DEFERRED_RETRY_MS.
+    constexpr int RULE_RATE_PER_SEC = 256;
+    constexpr int RULE_BURST = 1024;
+    constexpr int SYSCALL_BUDGET = 2048;
+    constexpr int BUDGET_WINDOW_MS = 1000;
+    constexpr int DEFERRED_RETRY_MS = 250;
+
+    // Binder pool threads of these processes are boosted only while busy:
+    // running, in a transaction, or using BINDER_ACTIVE_TICKS of CPU time
+    // per poll. They drop back after BINDER_IDLE_POLLS idle polls.
+    constexpr std::array<std::string_view, 1> BINDER_BOOST_TASKS = {"system_server"};
+    constexpr const char* BINDER_STATE = "/dev/binderfs/binder_logs/state";
+    constexpr const char* BINDER_STATE_DEBUGFS = "/sys/kernel/debug/binder/state"; // without binderfs
+    constexpr int BINDER_POLL_MS = 500;
+    constexpr unsigned long long BINDER_ACTIVE_TICKS = 2;
+    constexpr int BINDER_IDLE_POLLS = 4;
+
+    // CPU time sampling of managed threads, per rule and core tier
+    constexpr int UTIL_SAMPLE_MS = 5000;
+    constexpr size_t UTIL_MAX_FDS = 4096; // kept-open stat files
+
+    // Tier migration for rules with migrate set: a thread using at least
+    // PROMOTE_UTIL% of a core while CPU PSI (some avg10) is at least
+    // PROMOTE_PSI% for PROMOTE_SAMPLES samples widens from its rule's cores
+    // to all cores; DEMOTE_SAMPLES samples under DEMOTE_UTIL% send it back.
+    // No move happens within MIN_DWELL_MS of the previous one.
+    constexpr double TIER_PROMOTE_UTIL = 70.0;
+    constexpr double TIER_DEMOTE_UTIL = 20.0;
+    constexpr double TIER_PROMOTE_PSI = 10.0;
+    constexpr int TIER_PROMOTE_SAMPLES = 2;
+    constexpr int TIER_DEMOTE_SAMPLES = 3;
+    constexpr int TIER_MIN_DWELL_MS = 30000;
+    constexpr const char* CPU_PRESSURE = "/proc/pressure/cpu";
+
+    // Proactive reclaim for rules with reclaim set: while memory PSI (some
+    // avg10) is at least RECLAIM_PSI%, each matched process is advised
+    // cold/pageout at most once per RECLAIM_INTERVAL_MS
+    constexpr double RECLAIM_PSI = 5.0;
+    constexpr int RECLAIM_INTERVAL_MS = 60000;
+    constexpr const char* MEMORY_PRESSURE = "/proc/pressure/memory";
 }
 
-// Thread-safe logger with rotation
+// Thread-safe logger with rotation. Formats into a stack buffer and
+// writes with a single write(2), so logging never touches the heap.
 class Logger {
 private:
     static inline std::mutex logMutex;
     static constexpr size_t MAX_LOG_SIZE = 1024 * 1024; // 1MB
+    static constexpr size_t MAX_LINE = 512;
+    static inline bool echo = false;
 
     static void rotateLog(const char* logFile) {
-        try {
-            if (fs::file_size(logFile) > MAX_LOG_SIZE) {
-                fs::rename(logFile, std::string(logFile) + ".old");
-            }
-        } catch (...) {}
+        struct stat st;
+        if (stat(logFile, &st) == 0 && static_cast<size_t>(st.st_size) > MAX_LOG_SIZE) {
+            char oldPath[128];
+            std::snprintf(oldPath, sizeof(oldPath), "%s.old", logFile);
+            rename(logFile, oldPath);
+        }
     }
 
 public:
+    // Also copy log lines to stdout/stderr, for interactive subcommands
+    static void setEcho(bool enabled) { echo = enabled; }
+
     static void log(std::string_view message, bool isError = false) noexcept {
         std::lock_guard<std::mutex> lock(logMutex);
-        try {
-            const char* logFile = isError ? config::ERROR_LOG : config::MAIN_LOG;
-            rotateLog(logFile);
+        const char* logFile = isError ? config::ERROR_LOG : config::MAIN_LOG;
 
-            std::ofstream file(logFile, std::ios::app);
-            if (file.is_open()) {
-                auto now = std::chrono::system_clock::now();
-                auto time = std::chrono::system_clock::to_time_t(now);
-                file << "[" << std::put_time(std::localtime(&time), "%Y-%m-%d %H:%M:%S")
-                     << "] " << message << '\n';
-            }
-        } catch (const std::exception& e) {
-            std::cerr << "Logger error: " << e.what() << '\n';
+        if (echo) {
+            const int out = isError ? STDERR_FILENO : STDOUT_FILENO;
+            ssize_t ignored = write(out, message.data(), message.size());
+            ignored = write(out, "\n", 1);
+            (void)ignored;
+        }
+
+        rotateLog(logFile);
+        int fd = open(logFile, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) return;
+
+        char line[MAX_LINE];
+        time_t now = time(nullptr);
+        struct tm local;
+        localtime_r(&now, &local);
+        size_t len = strftime(line, sizeof(line), "[%Y-%m-%d %H:%M:%S] ", &local);
+        size_t msgLen = std::min(message.size(), sizeof(line) - len - 1);
+        std::memcpy(line + len, message.data(), msgLen);
+        len += msgLen;
+        line[len++] = '\n';
+
+        ssize_t ignored = write(fd, line, len);
+        (void)ignored;
+        close(fd);
+    }
+
+    __attribute__((format(printf, 2, 3)))
+    static void logf(bool isError, const char* fmt, ...) noexcept {
+        char message[MAX_LINE];
+        va_list args;
+        va_start(args, fmt);
+        int len = std::vsnprintf(message, sizeof(message), fmt, args);
+        va_end(args);
+        if (len < 0) return;
+        log(std::string_view(message, std::min<size_t>(len, sizeof(message) - 1)), isError);
+    }
+};
+
+// Optimizer trace events. Writes atrace-format lines to the ftrace
+// trace_marker, so actions line up with sched_switch in a system trace,
+// and optionally a Chrome JSON trace file. Disabled unless TRACE_FLAG
+// exists; its content "json" also enables the JSON file.
+class Tracer {
+private:
+    static inline int markerFd = -1;
+    static inline int jsonFd = -1;
+    static inline pid_t pid = 0;
+    static inline char jsonBuf[65536];
+    static inline size_t jsonLen = 0;
+    static constexpr size_t MAX_EVENT = 512;
+
+    static void writeMarker(const char* fmt, ...) __attribute__((format(printf, 1, 2))) {
+        char buf[MAX_EVENT];
+        va_list args;
+        va_start(args, fmt);
+        int len = std::vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        if (len <= 0) return;
+        ssize_t ignored = write(markerFd, buf, std::min<size_t>(len, sizeof(buf) - 1));
+        (void)ignored;
+    }
+
+    static void appendJson(const char* fmt, ...) __attribute__((format(printf, 1, 2))) {
+        if (jsonLen + MAX_EVENT > sizeof(jsonBuf)) flush();
+        va_list args;
+        va_start(args, fmt);
+        int len = std::vsnprintf(jsonBuf + jsonLen, MAX_EVENT, fmt, args);
+        va_end(args);
+        if (len > 0) jsonLen += std::min<size_t>(len, MAX_EVENT - 1);
+    }
+
+public:
+    static void init() {
+        char mode[16] = {};
+        if (readFlag(config::TRACE_FLAG, mode, sizeof(mode)) < 0) return;
+        pid = getpid();
+
+        markerFd = open("/sys/kernel/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+        if (markerFd < 0) markerFd = open("/sys/kernel/debug/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+
+        if (std::strncmp(mode, "json", 4) == 0) {
+            // JSON array format tolerates a missing "]", so the file
+            // stays valid while the daemon keeps appending to it
+            jsonFd = open(config::TRACE_JSON, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (jsonFd >= 0) appendJson("[\n");
+        }
+        Logger::logf(false, "Tracing: trace_marker %s, JSON %s",
+                     markerFd >= 0 ? "on" : "off", jsonFd >= 0 ? config::TRACE_JSON : "off");
+    }
+
+    static bool enabled() { return markerFd >= 0 || jsonFd >= 0; }
+
+    static uint64_t nowUs() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    // Opens a slice; returns its start time for end()
+    static uint64_t begin(const char* name) {
+        if (markerFd >= 0) writeMarker("B|%d|%s", pid, name);
+        return nowUs();
+    }
+
+    // Closes a slice. args is a JSON object body (without braces) or nullptr.
+    static void end(const char* name, uint64_t startUs, const char* args = nullptr) {
+        if (markerFd >= 0) writeMarker("E|%d", pid);
+        if (jsonFd >= 0) {
+            appendJson("{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,"
+                       "\"pid\":%d,\"tid\":%d,\"args\":{%s}},\n",
+                       name, static_cast<unsigned long long>(startUs),
+                       static_cast<unsigned long long>(nowUs() - startUs), pid, pid,
+                       args ? args : "");
+        }
+    }
+
+    static void counter(const char* name, long long value) {
+        if (markerFd >= 0) writeMarker("C|%d|%s|%lld", pid, name, value);
+        if (jsonFd >= 0) {
+            appendJson("{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%llu,\"pid\":%d,"
+                       "\"args\":{\"value\":%lld}},\n",
+                       name, static_cast<unsigned long long>(nowUs()), pid, value);
+        }
+    }
+
+    // Copies src into dst with JSON string escaping, dropping control bytes
+    static const char* escape(char* dst, size_t size, std::string_view src) {
+        size_t out = 0;
+        for (char c : src) {
+            if (static_cast<unsigned char>(c) < 0x20) continue;
+            const bool special = c == '"' || c == '\\';
+            if (out + 2 + special >= size) break;
+            if (special) dst[out++] = '\\';
+            dst[out++] = c;
+        }
+        dst[out] = '\0';
+        return dst;
+    }
+
+    static void flush() {
+        if (jsonFd < 0 || jsonLen == 0) return;
+        ssize_t ignored = write(jsonFd, jsonBuf, jsonLen);
+        (void)ignored;
+        jsonLen = 0;
+    }
+
+    // Slice covering a scope
+    class Scope {
+    private:
+        const char* name;
+        uint64_t start = 0;
+
+    public:
+        explicit Scope(const char* sliceName) : name(sliceName) {
+            if (enabled()) start = begin(name);
+        }
+        ~Scope() {
+            if (enabled()) end(name, start);
         }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+private:
+    static ssize_t readFlag(const char* path, char* buf, size_t size) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return -1;
+        ssize_t n = read(fd, buf, size - 1);
+        close(fd);
+        if (n >= 0) buf[n] = '\0';
+        return n;
     }
 };
 
@@ -91,38 +392,181 @@ public:
         return result;
     }
 
+    // Upper bound for pids, from /proc/sys/kernel/pid_max (read once)
+    static pid_t pidMax() {
+        static const pid_t limit = [] {
+            constexpr pid_t PID_MAX_LIMIT = 4194304; // kernel maximum on 64-bit
+            char buf[16] = {};
+            int fd = open("/proc/sys/kernel/pid_max", O_RDONLY | O_CLOEXEC);
+            if (fd < 0) return PID_MAX_LIMIT;
+            ssize_t n = read(fd, buf, sizeof(buf) - 1);
+            close(fd);
+            const long value = n > 0 ? std::strtol(buf, nullptr, 10) : 0;
+            return value > 0 && value <= PID_MAX_LIMIT ? static_cast<pid_t>(value) : PID_MAX_LIMIT;
+        }();
+        return limit;
+    }
+
+    // Range check only: whether tid still names the intended task is
+    // decided by its TaskId, and a vanished tid makes the syscall fail
     static bool isValidPID(pid_t pid) {
-        return pid > 0 && pid < 99999 &&
-               fs::exists("/proc/" + std::to_string(pid));
+        return pid > 0 && pid < pidMax();
     }
 
     static bool isValidPattern(std::string_view pattern) {
-        // Prevent regex DoS and injection
+        // Prevent oversized patterns and injection
         return pattern.length() < 100 &&
                pattern.find_first_of(";&|`$(){}[]<>") == std::string::npos;
     }
 };
 
+// Process name pattern: a literal substring of comm, optionally anchored
+// with a leading '^' and/or trailing '$'. Matching never allocates.
+class NamePattern {
+private:
+    std::string literal;
+    bool anchorStart = false;
+    bool anchorEnd = false;
+
+public:
+    explicit NamePattern(std::string_view pattern) {
+        if (!pattern.empty() && pattern.front() == '^') {
+            anchorStart = true;
+            pattern.remove_prefix(1);
+        }
+        if (!pattern.empty() && pattern.back() == '$') {
+            anchorEnd = true;
+            pattern.remove_suffix(1);
+        }
+        literal.assign(pattern);
+    }
+
+    bool matches(std::string_view name) const {
+        if (anchorStart && anchorEnd) return name == literal;
+        if (anchorStart) return name.substr(0, literal.size()) == literal;
+        if (anchorEnd) {
+            return name.size() >= literal.size() &&
+                   name.substr(name.size() - literal.size()) == literal;
+        }
+        return name.find(literal) != std::string_view::npos;
+    }
+};
+
 // CPU topology detector
 class CPUTopology {
 private:
+    // One frequency step; power is 0 when no energy model is readable
+    struct OperatingPoint {
+        int freq = 0;  // kHz
+        int power = 0; // mW
+    };
+
+    // CPUs sharing a cpufreq policy
+    struct PerfDomain {
+        cpu_set_t cpus;
+        int firstCpu = 0;
+        int capacity = 1024; // cpu_capacity at max frequency
+        int maxFreq = 0;
+        std::vector<OperatingPoint> opps; // ascending frequency
+    };
+
     struct CoreInfo {
         std::vector<int> perfCores;
         std::vector<int> effCores;
         int totalCores = 0;
+        std::vector<PerfDomain> domains;
+        bool energyModel = false;
     };
 
+    // Whitespace-separated integers of a small sysfs file; empty if unreadable
+    static std::vector<int> readInts(const char* path) {
+        std::vector<int> values;
+        char buf[1024];
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return values;
+        ssize_t n = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (n <= 0) return values;
+        buf[n] = '\0';
+
+        char* end = nullptr;
+        for (const char* p = buf;; p = end) {
+            const long value = std::strtol(p, &end, 10);
+            if (end == p) break;
+            values.push_back(static_cast<int>(value));
+        }
+        return values;
+    }
+
+    static std::vector<int> readCpuInts(int cpu, const char* leaf) {
+        char path[128];
+        std::snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, leaf);
+        return readInts(path);
+    }
+
+    // Power for each OPP from the kernel energy model in debugfs. Newer
+    // kernels name domains cpuN/ps:<freq>, older ones pdN/cs:<freq>.
+    static bool readEnergyModel(PerfDomain& domain, size_t index) {
+        char path[128];
+        for (auto& opp : domain.opps) {
+            std::snprintf(path, sizeof(path), "/sys/kernel/debug/energy_model/cpu%d/ps:%d/power",
+                          domain.firstCpu, opp.freq);
+            auto power = readInts(path);
+            if (power.empty()) {
+                std::snprintf(path, sizeof(path), "/sys/kernel/debug/energy_model/pd%zu/cs:%d/power",
+                              index, opp.freq);
+                power = readInts(path);
+            }
+            if (power.empty() || power[0] <= 0) return false;
+            opp.power = power[0];
+        }
+        return !domain.opps.empty();
+    }
+
+    static void detectDomains(CoreInfo& info) {
+        for (int cpu = 0; cpu < info.totalCores; ++cpu) {
+            bool known = std::any_of(info.domains.begin(), info.domains.end(),
+                                     [cpu](const PerfDomain& d) { return CPU_ISSET(cpu, &d.cpus); });
+            if (known) continue;
+
+            PerfDomain domain;
+            CPU_ZERO(&domain.cpus);
+            domain.firstCpu = cpu;
+            auto related = readCpuInts(cpu, "cpufreq/related_cpus");
+            if (related.empty()) related.push_back(cpu);
+            for (int c : related) {
+                if (c >= 0 && c < CPU_SETSIZE) CPU_SET(c, &domain.cpus);
+            }
+
+            auto capacity = readCpuInts(cpu, "cpu_capacity");
+            if (!capacity.empty()) domain.capacity = capacity[0];
+            auto maxFreq = readCpuInts(cpu, "cpufreq/cpuinfo_max_freq");
+            domain.maxFreq = maxFreq.empty() ? 0 : maxFreq[0];
+
+            for (int freq : readCpuInts(cpu, "cpufreq/scaling_available_frequencies")) {
+                domain.opps.push_back({freq, 0});
+            }
+            if (domain.opps.empty() && domain.maxFreq > 0) domain.opps.push_back({domain.maxFreq, 0});
+            std::sort(domain.opps.begin(), domain.opps.end(),
+                      [](const auto& a, const auto& b) { return a.freq < b.freq; });
+
+            info.domains.push_back(std::move(domain));
+        }
+
+        info.energyModel = !info.domains.empty();
+        for (size_t i = 0; i < info.domains.size(); ++i) {
+            info.energyModel &= readEnergyModel(info.domains[i], i);
+        }
+    }
+
     static CoreInfo detectCores() {
         CoreInfo info;
         try {
             for (int i = 0; i < 16; ++i) {
-                std::string freqPath = "/sys/devices/system/cpu/cpu" +
-                                      std::to_string(i) + "/cpufreq/cpuinfo_max_freq";
-                std::ifstream freqFile(freqPath);
-                if (!freqFile.is_open()) break;
+                const auto freq = readCpuInts(i, "cpufreq/cpuinfo_max_freq");
+                if (freq.empty()) break;
 
-                int maxFreq;
-                freqFile >> maxFreq;
+                const int maxFreq = freq[0];
                 info.totalCores++;
 
                 // Cores > 2GHz are performance cores
@@ -132,155 +576,381 @@ private:
                     info.effCores.push_back(i);
                 }
             }
+            detectDomains(info);
         } catch (...) {
             Logger::log("Failed to detect CPU topology, using defaults", true);
             info.perfCores = {4, 5, 6, 7};
             info.effCores = {0, 1, 2, 3};
             info.totalCores = 8;
+            info.domains.clear();
         }
         return info;
     }
 
+    static const CoreInfo& info() {
+        static const CoreInfo detected = detectCores();
+        return detected;
+    }
+
 public:
+    // Core tiers as split by getPerfMask / getEffMask; Other covers CPUs
+    // outside both, e.g. when cpufreq is missing
+    enum class Tier : uint8_t { Eff, Perf, Other, Count };
+    static constexpr std::array<const char*, static_cast<size_t>(Tier::Count)> TIER_NAMES = {
+        "eff", "perf", "other"
+    };
+
+    static Tier tierOf(int cpu) {
+        // Indexed once; called per sampled thread
+        static const std::array<Tier, CPU_SETSIZE> tiers = [] {
+            std::array<Tier, CPU_SETSIZE> map;
+            map.fill(Tier::Other);
+            for (int core : info().effCores) map[core] = Tier::Eff;
+            for (int core : info().perfCores) map[core] = Tier::Perf;
+            return map;
+        }();
+        return cpu >= 0 && cpu < CPU_SETSIZE ? tiers[cpu] : Tier::Other;
+    }
+
     static cpu_set_t getPerfMask() {
-        static CoreInfo info = detectCores();
         cpu_set_t mask;
         CPU_ZERO(&mask);
-        for (int core : info.perfCores) {
+        for (int core : info().perfCores) {
             CPU_SET(core, &mask);
         }
         return mask;
     }
 
     static cpu_set_t getEffMask() {
-        static CoreInfo info = detectCores();
         cpu_set_t mask;
         CPU_ZERO(&mask);
-        for (int core : info.effCores) {
+        for (int core : info().effCores) {
             CPU_SET(core, &mask);
         }
         return mask;
     }
 
+    // Cores of the domain that sustains minCapacity (0-1024 scale) for the
+    // least energy. With an energy model the cost of each feasible OPP is
+    // power * minCapacity / capacityAtOpp, i.e. the power drawn while busy
+    // for that share of time. Without one, the smallest domain able to reach
+    // minCapacity wins, as small cores do more work per joule.
+    static cpu_set_t getEnergyMask(int minCapacity) {
+        const CoreInfo& topo = info();
+        const PerfDomain* best = nullptr;
+        double bestCost = 0;
+
+        for (const auto& domain : topo.domains) {
+            if (domain.capacity < minCapacity) continue;
+
+            double cost = domain.capacity;
+            if (topo.energyModel && domain.maxFreq > 0) {
+                cost = -1;
+                for (const auto& opp : domain.opps) {
+                    double capacityAt = static_cast<double>(domain.capacity) * opp.freq / domain.maxFreq;
+                    if (capacityAt < minCapacity || capacityAt <= 0) continue;
+                    double oppCost = opp.power * minCapacity / capacityAt;
+                    if (cost < 0 || oppCost < cost) cost = oppCost;
+                }
+                if (cost < 0) continue;
+            }
+            if (!best || cost < bestCost) {
+                best = &domain;
+                bestCost = cost;
+            }
+        }
+
+        if (!best) {
+            // Nothing reaches minCapacity: take the biggest cores available
+            for (const auto& domain : topo.domains) {
+                if (!best || domain.capacity > best->capacity) best = &domain;
+            }
+        }
+        return best ? best->cpus : getEffMask();
+    }
+
+    // Capacity-per-watt tiers, most efficient first
+    static void logTopology() {
+        const CoreInfo& topo = info();
+        std::vector<std::pair<double, const PerfDomain*>> tiers;
+        for (const auto& domain : topo.domains) {
+            double efficiency = 0;
+            if (topo.energyModel && !domain.opps.empty()) {
+                efficiency = static_cast<double>(domain.capacity) / domain.opps.back().power;
+            }
+            tiers.emplace_back(efficiency, &domain);
+        }
+        std::sort(tiers.begin(), tiers.end(), [](const auto& a, const auto& b) {
+            return a.first != b.first ? a.first > b.first : a.second->capacity < b.second->capacity;
+        });
+
+        for (const auto& [efficiency, domain] : tiers) {
+            if (topo.energyModel) {
+                Logger::logf(false, "Tier cpu%d (%d cpus): capacity %d, %.2f capacity/mW at max freq",
+                             domain->firstCpu, CPU_COUNT(&domain->cpus), domain->capacity, efficiency);
+            } else {
+                Logger::logf(false, "Tier cpu%d (%d cpus): capacity %d, no energy model",
+                             domain->firstCpu, CPU_COUNT(&domain->cpus), domain->capacity);
+            }
+        }
+    }
+
+    // Energy: cheapest cores for a minimum capacity, see getEnergyMask;
+    // Expr: a parseMask expression
+    enum class CoreSet : uint8_t { None, Perf, Eff, All, Energy, Expr };
+
+    static cpu_set_t getMask(CoreSet set, int minCapacity = 0) {
+        switch (set) {
+            case CoreSet::Perf: return getPerfMask();
+            case CoreSet::Eff: return getEffMask();
+            case CoreSet::All: return getAllMask();
+            case CoreSet::Energy: return getEnergyMask(minCapacity);
+            case CoreSet::None:
+            case CoreSet::Expr: break;
+        }
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        return mask;
+    }
+
     static cpu_set_t getAllMask() {
-        static CoreInfo info = detectCores();
         cpu_set_t mask;
         CPU_ZERO(&mask);
-        for (int i = 0; i < info.totalCores; ++i) {
+        for (int i = 0; i < info().totalCores; ++i) {
             CPU_SET(i, &mask);
         }
         return mask;
     }
-};
 
-// Direct syscall wrapper
-class SyscallOptimizer {
+    // Formats a mask as a cpulist, e.g. "0-3,6"
+    static const char* formatMask(const cpu_set_t& mask, char* buf, size_t size) {
+        size_t len = 0;
+        buf[0] = '\0';
+        for (int cpu = 0; cpu < CPU_SETSIZE && len < size; ++cpu) {
+            if (!CPU_ISSET(cpu, &mask)) continue;
+            int last = cpu;
+            while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &mask)) ++last;
+            int n = last == cpu
+                ? std::snprintf(buf + len, size - len, "%s%d", len ? "," : "", cpu)
+                : std::snprintf(buf + len, size - len, "%s%d-%d", len ? "," : "", cpu, last);
+            if (n < 0) break;
+            len += static_cast<size_t>(n);
+            cpu = last;
+        }
+        if (len == 0) std::snprintf(buf, size, "none");
+        return buf;
+    }
+
+    // Compiles a mask expression against the detected topology:
+    //   expr  := term ('|' term)*        union
+    //   term  := unary ('&' unary)*      intersection
+    //   unary := '!' unary | '(' expr ')' | atom
+    //   atom  := all | perf | eff | little | mid | big | prime
+    //          | cpuN | cluster(N) | cpus(LIST)
+    // Clusters are cpufreq policies: little is the smallest, prime the
+    // largest, big everything but little and mid everything in between.
+    // cluster(N) counts from cpu0 and '!' complements within all.
+    // Returns false on a syntax error; the mask may come out empty.
+    static bool parseMask(const char* text, cpu_set_t& out) {
+        MaskParser parser(text);
+        return parser.parse(out);
+    }
+
 private:
-    struct OpResult {
-        bool success;
-        std::string error;
-    };
+    // Clusters ordered by capacity, then max frequency when cpu_capacity
+    // is missing and every cluster reads 1024
+    static std::vector<const PerfDomain*> clustersBySize() {
+        std::vector<const PerfDomain*> clusters;
+        for (const auto& domain : info().domains) clusters.push_back(&domain);
+        std::sort(clusters.begin(), clusters.end(), [](const PerfDomain* a, const PerfDomain* b) {
+            if (a->capacity != b->capacity) return a->capacity < b->capacity;
+            if (a->maxFreq != b->maxFreq) return a->maxFreq < b->maxFreq;
+            return a->firstCpu < b->firstCpu;
+        });
+        return clusters;
+    }
 
-    static OpResult setAffinityDirect(pid_t tid, const cpu_set_t& mask) {
-        if (!Sanitizer::isValidPID(tid)) {
-            return {false, "Invalid TID"};
+    class MaskParser {
+    private:
+        const char* p;
+        bool ok = true;
+
+        static cpu_set_t none() {
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+            return mask;
         }
 
-        if (sched_setaffinity(tid, sizeof(cpu_set_t), &mask) == 0) {
-            return {true, ""};
+        void skipSpace() {
+            while (*p == ' ') ++p;
         }
-        return {false, "sched_setaffinity failed: " + std::string(strerror(errno))};
-    }
 
-    static OpResult setNiceDirect(pid_t tid, int value) {
-        if (!Sanitizer::isValidPID(tid)) {
-            return {false, "Invalid TID"};
+        bool accept(char c) {
+            skipSpace();
+            if (*p != c) return false;
+            ++p;
+            return true;
         }
 
-        errno = 0;
-        if (setpriority(PRIO_PROCESS, tid, value) == 0 || errno == 0) {
-            return {true, ""};
+        int number() {
+            skipSpace();
+            if (!std::isdigit(static_cast<unsigned char>(*p))) {
+                ok = false;
+                return 0;
+            }
+            char* end = nullptr;
+            const long value = std::strtol(p, &end, 10);
+            p = end;
+            if (value >= CPU_SETSIZE) ok = false;
+            return static_cast<int>(value);
         }
-        return {false, "setpriority failed: " + std::string(strerror(errno))};
-    }
 
-    static OpResult setRTDirect(pid_t tid, int priority) {
-        if (!Sanitizer::isValidPID(tid)) {
-            return {false, "Invalid TID"};
+        // Union of clusters [first, last) in size order
+        static cpu_set_t clusters(size_t first, size_t last) {
+            const auto sorted = clustersBySize();
+            cpu_set_t mask = none();
+            for (size_t i = first; i < last && i < sorted.size(); ++i) {
+                CPU_OR(&mask, &mask, &sorted[i]->cpus);
+            }
+            return mask;
         }
 
-        struct sched_param param;
-        param.sched_priority = priority;
+        cpu_set_t atom() {
+            skipSpace();
+            const char* start = p;
+            while (std::islower(static_cast<unsigned char>(*p))) ++p;
+            const std::string_view word(start, static_cast<size_t>(p - start));
+            const size_t count = info().domains.size();
 
-        if (sched_setscheduler(tid, SCHED_FIFO, &param) == 0) {
-            return {true, ""};
+            if (word == "all") return getAllMask();
+            if (word == "perf") return getPerfMask();
+            if (word == "eff") return getEffMask();
+            if (word == "little") return clusters(0, 1);
+            if (word == "mid") return clusters(1, count ? count - 1 : 0);
+            if (word == "big") return count > 1 ? clusters(1, count) : getAllMask();
+            if (word == "prime") return count > 1 ? clusters(count - 1, count) : getAllMask();
+
+            cpu_set_t mask = none();
+            if (word == "cpu") {
+                const int cpu = number();
+                if (ok) CPU_SET(cpu, &mask);
+            } else if (word == "cluster") {
+                if (!accept('(')) ok = false;
+                const int index = number();
+                if (!accept(')')) ok = false;
+                // Domains are detected in cpu order
+                if (ok && static_cast<size_t>(index) < count) mask = info().domains[index].cpus;
+            } else if (word == "cpus") {
+                if (!accept('(')) ok = false;
+                do {
+                    const int first = number();
+                    const int last = accept('-') ? number() : first;
+                    if (!ok || last < first) {
+                        ok = false;
+                        break;
+                    }
+                    for (int cpu = first; cpu <= last; ++cpu) CPU_SET(cpu, &mask);
+                } while (accept(','));
+                if (!accept(')')) ok = false;
+            } else {
+                ok = false;
+            }
+            return mask;
         }
-        return {false, "sched_setscheduler failed: " + std::string(strerror(errno))};
-    }
 
-    static OpResult setIOPrioDirect(pid_t tid, int ioClass) {
-        if (!Sanitizer::isValidPID(tid)) {
-            return {false, "Invalid TID"};
+        cpu_set_t unary() {
+            if (accept('!')) {
+                const cpu_set_t operand = unary();
+                cpu_set_t mask = getAllMask();
+                for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                    if (CPU_ISSET(cpu, &operand)) CPU_CLR(cpu, &mask);
+                }
+                return mask;
+            }
+            if (accept('(')) {
+                const cpu_set_t mask = expr();
+                if (!accept(')')) ok = false;
+                return mask;
+            }
+            return atom();
         }
 
-        // ioprio_set syscall
-        constexpr int IOPRIO_WHO_PROCESS = 1;
-        constexpr int IOPRIO_CLASS_SHIFT = 13;
-        int ioprio = (ioClass << IOPRIO_CLASS_SHIFT);
+        cpu_set_t term() {
+            cpu_set_t mask = unary();
+            while (ok && accept('&')) {
+                const cpu_set_t operand = unary();
+                CPU_AND(&mask, &mask, &operand);
+            }
+            return mask;
+        }
 
-        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, ioprio) == 0) {
-            return {true, ""};
+        cpu_set_t expr() {
+            cpu_set_t mask = term();
+            while (ok && accept('|')) {
+                const cpu_set_t operand = term();
+                CPU_OR(&mask, &mask, &operand);
+            }
+            return mask;
         }
-        return {false, "ioprio_set failed: " + std::string(strerror(errno))};
-    }
 
-public:
-    static bool setAffinity(pid_t tid, const cpu_set_t& mask) {
-        for (int retry = 0; retry < config::MAX_RETRIES; ++retry) {
-            auto result = setAffinityDirect(tid, mask);
-            if (result.success) return true;
+    public:
+        explicit MaskParser(const char* text) : p(text) {}
 
-            if (retry < config::MAX_RETRIES - 1) {
-                std::this_thread::sleep_for(
-                    std::chrono::milliseconds(config::RETRY_DELAY_MS)
-                );
-            }
+        bool parse(cpu_set_t& out) {
+            out = expr();
+            skipSpace();
+            return ok && *p == '\0';
         }
-        return false;
+    };
+};
+
+// Direct syscall wrapper
+class SyscallOptimizer {
+private:
+    // Each direct setter returns 0 or an errno value
+    static int setAffinityDirect(pid_t tid, const cpu_set_t& mask) {
+        if (!Sanitizer::isValidPID(tid)) return ESRCH;
+        return sched_setaffinity(tid, sizeof(cpu_set_t), &mask) == 0 ? 0 : errno;
     }
 
-    static bool setNice(pid_t tid, int value) {
-        for (int retry = 0; retry < config::MAX_RETRIES; ++retry) {
-            auto result = setNiceDirect(tid, value);
-            if (result.success) return true;
+    static int setNiceDirect(pid_t tid, int value) {
+        if (!Sanitizer::isValidPID(tid)) return ESRCH;
 
-            if (retry < config::MAX_RETRIES - 1) {
-                std::this_thread::sleep_for(
-                    std::chrono::milliseconds(config::RETRY_DELAY_MS)
-                );
-            }
-        }
-        return false;
+        errno = 0;
+        if (setpriority(PRIO_PROCESS, tid, value) == 0 || errno == 0) return 0;
+        return errno;
     }
 
-    static bool setRT(pid_t tid, int priority) {
-        for (int retry = 0; retry < config::MAX_RETRIES; ++retry) {
-            auto result = setRTDirect(tid, priority);
-            if (result.success) return true;
+    static int setRTDirect(pid_t tid, int priority) {
+        if (!Sanitizer::isValidPID(tid)) return ESRCH;
 
-            if (retry < config::MAX_RETRIES - 1) {
-                std::this_thread::sleep_for(
-                    std::chrono::milliseconds(config::RETRY_DELAY_MS)
-                );
-            }
-        }
-        return false;
+        struct sched_param param;
+        param.sched_priority = priority;
+        return sched_setscheduler(tid, SCHED_FIFO, &param) == 0 ? 0 : errno;
+    }
+
+    // ioprio_set syscall
+    static constexpr int IOPRIO_WHO_PROCESS = 1;
+    static constexpr int IOPRIO_WHO_PGRP = 2;
+    static constexpr int IOPRIO_CLASS_SHIFT = 13;
+
+    static int setIOPrioDirect(pid_t tid, int ioprio) {
+        if (!Sanitizer::isValidPID(tid)) return ESRCH;
+        return syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, ioprio) == 0 ? 0 : errno;
+    }
+
+    // EINVAL (bound kthread, bad mask), EPERM and ESRCH won't change on retry
+    static bool isTransient(int err) {
+        return err == EAGAIN || err == EBUSY || err == EINTR || err == ENOMEM;
     }
 
-    static bool setIOPrio(pid_t tid, int ioClass) {
+    // Retries a direct setter on transient errors; returns 0 or the last errno
+    template <typename Fn>
+    static int withRetries(Fn&& op) {
+        int err = 0;
         for (int retry = 0; retry < config::MAX_RETRIES; ++retry) {
-            auto result = setIOPrioDirect(tid, ioClass);
-            if (result.success) return true;
+            err = op();
+            if (err == 0 || !isTransient(err)) return err;
 
             if (retry < config::MAX_RETRIES - 1) {
                 std::this_thread::sleep_for(
@@ -288,173 +958,4312 @@ public:
                 );
             }
         }
-        return false;
+        return err;
     }
-};
 
-// Process utilities with TOCTOU protection
-class ProcessUtils {
 public:
-    static std::vector<pid_t> getProcessIDs(std::string_view pattern) {
-        if (!Sanitizer::isValidPattern(pattern)) {
-            Logger::log("Invalid pattern: " + std::string(pattern), true);
-            return {};
-        }
+    static int setAffinity(pid_t tid, const cpu_set_t& mask) {
+        return withRetries([&] { return setAffinityDirect(tid, mask); });
+    }
 
-        std::vector<pid_t> pids;
-        std::regex regex(std::string(pattern), std::regex_constants::optimize);
+    static int setNice(pid_t tid, int value) {
+        return withRetries([&] { return setNiceDirect(tid, value); });
+    }
 
-        try {
-            std::error_code ec;
-            for (const auto& entry : fs::directory_iterator("/proc", ec)) {
-                if (ec || !entry.is_directory()) continue;
+    static int setRT(pid_t tid, int priority) {
+        return withRetries([&] { return setRTDirect(tid, priority); });
+    }
 
-                const auto filename = entry.path().filename().string();
-                if (!std::all_of(filename.begin(), filename.end(), ::isdigit)) continue;
+    // I/O classes; RT and BE take a level from 0 (highest) to 7
+    static constexpr int IOPRIO_CLASS_NONE = 0;
+    static constexpr int IOPRIO_CLASS_RT = 1;
+    static constexpr int IOPRIO_CLASS_BE = 2;
+    static constexpr int IOPRIO_CLASS_IDLE = 3;
+    static constexpr int IOPRIO_LEVELS = 8;
 
-                pid_t pid = std::stoi(filename);
-                if (!Sanitizer::isValidPID(pid)) continue;
+    static constexpr int makeIOPrio(int ioClass, int level) {
+        return ioClass << IOPRIO_CLASS_SHIFT | level;
+    }
+    static int ioClassOf(int ioprio) { return ioprio >> IOPRIO_CLASS_SHIFT; }
+    static int ioLevelOf(int ioprio) { return ioprio & ((1 << IOPRIO_CLASS_SHIFT) - 1); }
 
-                std::ifstream commFile(entry.path() / "comm");
-                std::string comm;
-                if (std::getline(commFile, comm) && std::regex_search(comm, regex)) {
-                    pids.push_back(pid);
-                }
-            }
-        } catch (const std::exception& e) {
-            Logger::log("Error in getProcessIDs: " + std::string(e.what()), true);
+    // "rt/4", "be/0", "idle" or "none"
+    static const char* formatIOPrio(int ioprio, char* buf, size_t size) {
+        static constexpr const char* CLASSES[] = {"none", "rt", "be", "idle"};
+        const int ioClass = ioClassOf(ioprio);
+        if (ioClass < IOPRIO_CLASS_NONE || ioClass > IOPRIO_CLASS_IDLE) {
+            std::snprintf(buf, size, "%d", ioprio);
+        } else if (ioClass == IOPRIO_CLASS_RT || ioClass == IOPRIO_CLASS_BE) {
+            std::snprintf(buf, size, "%s/%d", CLASSES[ioClass], ioLevelOf(ioprio));
+        } else {
+            std::snprintf(buf, size, "%s", CLASSES[ioClass]);
         }
-
-        return pids;
+        return buf;
     }
 
-    static std::vector<pid_t> getThreadIDs(pid_t pid) {
-        if (!Sanitizer::isValidPID(pid)) return {};
+    // ioprio is a makeIOPrio value
+    static int setIOPrio(pid_t tid, int ioprio) {
+        return withRetries([&] { return setIOPrioDirect(tid, ioprio); });
+    }
 
-        std::vector<pid_t> tids;
-        const std::string taskDir = "/proc/" + std::to_string(pid) + "/task";
+    // Back to SCHED_OTHER at the given nice, e.g. to relax an RT task
+    static int setNormal(pid_t tid, int nice) {
+        int err = withRetries([&] {
+            if (!Sanitizer::isValidPID(tid)) return ESRCH;
+            struct sched_param param;
+            param.sched_priority = 0;
+            return sched_setscheduler(tid, SCHED_OTHER, &param) == 0 ? 0 : errno;
+        });
+        return err ? err : setNice(tid, nice);
+    }
 
-        try {
-            std::error_code ec;
-            for (const auto& entry : fs::directory_iterator(taskDir, ec)) {
-                if (ec || !entry.is_directory()) continue;
-
-                const auto tidStr = entry.path().filename().string();
-                if (std::all_of(tidStr.begin(), tidStr.end(), ::isdigit)) {
-                    pid_t tid = std::stoi(tidStr);
-                    if (Sanitizer::isValidPID(tid)) {
-                        tids.push_back(tid);
-                    }
-                }
-            }
-        } catch (const std::exception& e) {
-            Logger::log("Error in getThreadIDs: " + std::string(e.what()), true);
-        }
+    // Process-group variants: the kernel walks every thread of every
+    // process in the group, so one call covers a whole thread group.
+    // Callers fall back to per-thread setters on failure, so no retries.
+    static int setNiceGroup(pid_t pgid, int value) {
+        errno = 0;
+        if (setpriority(PRIO_PGRP, pgid, value) == 0 || errno == 0) return 0;
+        return errno;
+    }
 
-        return tids;
+    static int setIOPrioGroup(pid_t pgid, int ioprio) {
+        return syscall(SYS_ioprio_set, IOPRIO_WHO_PGRP, pgid, ioprio) == 0 ? 0 : errno;
     }
-};
 
-// Stats tracking
-class StatsTracker {
-private:
-    std::atomic<int> successCount{0};
-    std::atomic<int> failureCount{0};
-    std::atomic<int> totalOps{0};
+    // Current scheduling state of a thread, as the setters above see it
+    struct SchedState {
+        int nice = 0;
+        int policy = SCHED_OTHER;
+        int rtPriority = 0;
+        int ioprio = 0; // raw ioprio_get value: class << 13 | level
+        cpu_set_t affinity;
+    };
 
-public:
-    void recordSuccess() { ++successCount; ++totalOps; }
-    void recordFailure() { ++failureCount; ++totalOps; }
+    static int getState(pid_t tid, SchedState& state) {
+        if (!Sanitizer::isValidPID(tid)) return ESRCH;
 
-    void report() {
-        Logger::log("Operations: " + std::to_string(totalOps.load()) +
-                   " | Success: " + std::to_string(successCount.load()) +
-                   " | Failed: " + std::to_string(failureCount.load()));
-    }
-};
+        errno = 0;
+        state.nice = getpriority(PRIO_PROCESS, tid);
+        if (errno) return errno;
 
-// Main optimizer
-class TaskOptimizer {
-private:
-    StatsTracker stats;
+        state.policy = sched_getscheduler(tid);
+        if (state.policy < 0) return errno;
+        struct sched_param param;
+        if (sched_getparam(tid, &param) != 0) return errno;
+        state.rtPriority = param.sched_priority;
 
-public:
-    void optimizePattern(std::string_view pattern,
-                        std::function<bool(pid_t)> optimizer,
-                        std::string_view opName) {
-        auto pids = ProcessUtils::getProcessIDs(pattern);
-        if (pids.empty()) {
-            Logger::log("No processes found for: " + std::string(pattern));
-            return;
-        }
+        long ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, tid);
+        if (ioprio < 0) return errno;
+        state.ioprio = static_cast<int>(ioprio);
 
-        for (pid_t pid : pids) {
-            auto tids = ProcessUtils::getThreadIDs(pid);
-            for (pid_t tid : tids) {
-                if (optimizer(tid)) {
-                    stats.recordSuccess();
-                } else {
-                    stats.recordFailure();
-                    Logger::log("Failed " + std::string(opName) +
-                               " for TID " + std::to_string(tid), true);
-                }
-            }
-        }
+        CPU_ZERO(&state.affinity);
+        return sched_getaffinity(tid, sizeof(cpu_set_t), &state.affinity) == 0 ? 0 : errno;
     }
 
-    void reportStats() {
-        stats.report();
+    // Reapplies a state read by getState, policy first so nice sticks
+    // Puts tid back on a policy read by getState; nice applies to the
+    // non-RT policies only
+    static int setPolicy(pid_t tid, int policy, int rtPriority, int nice) {
+        if (!Sanitizer::isValidPID(tid)) return ESRCH;
+
+        struct sched_param param;
+        param.sched_priority = rtPriority;
+        if (sched_setscheduler(tid, policy, &param) != 0) return errno;
+        if (policy == SCHED_FIFO || policy == SCHED_RR) return 0;
+        return setNiceDirect(tid, nice);
     }
-};
 
-void optimizeSystem() {
-    Logger::log("=== Starting Advanced System Optimization ===");
+    static int setState(pid_t tid, const SchedState& state) {
+        if (int err = setPolicy(tid, state.policy, state.rtPriority, state.nice)) return err;
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, state.ioprio) != 0) return errno;
+        if (CPU_COUNT(&state.affinity) == 0) return 0;
+        return sched_setaffinity(tid, sizeof(cpu_set_t), &state.affinity) == 0 ? 0 : errno;
+    }
+};
+
+// Process utilities with TOCTOU protection
+class ProcessUtils {
+public:
+    // stat's comm is TASK_COMM_LEN (16) for most tasks, but kworkers append
+    // their workqueue ("kworker/u16:3+writeback") up to a 64-byte buffer
+    static constexpr size_t COMM_LEN = 64;
+
+    // Fields of /proc/<pid>/stat used by the scanner
+    struct ProcStat {
+        char comm[COMM_LEN] = {};
+        char state = '?';
+        pid_t ppid = 0;
+        pid_t pgrp = 0;
+        unsigned int flags = 0; // field 9, PF_* task flags
+        unsigned long long cpuTime = 0; // utime + stime, fields 14-15, clock ticks
+        unsigned long long startTime = 0; // field 22, clock ticks since boot
+    };
+
+    // Single open/read/close; returns bytes read or -1
+    static ssize_t readFile(const char* path, char* buf, size_t size) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return -1;
+        ssize_t n = read(fd, buf, size - 1);
+        close(fd);
+        if (n < 0) return -1;
+        buf[n] = '\0';
+        return n;
+    }
+
+    // Single open/write/close; returns 0 or errno
+    static int writeFile(const char* path, const char* data, size_t len) {
+        int fd = open(path, O_WRONLY | O_CLOEXEC);
+        if (fd < 0) return errno;
+        int err = write(fd, data, len) == static_cast<ssize_t>(len) ? 0 : errno;
+        close(fd);
+        return err;
+    }
+
+    // mkdir -p; returns 0 or errno
+    static int makeDirs(const char* path) {
+        char dir[256];
+        const size_t len = std::strlen(path);
+        if (len >= sizeof(dir)) return ENAMETOOLONG;
+        std::memcpy(dir, path, len + 1);
+        for (size_t i = 1; i <= len; ++i) {
+            if (dir[i] != '/' && dir[i] != '\0') continue;
+            const char saved = dir[i];
+            dir[i] = '\0';
+            if (mkdir(dir, 0755) != 0 && errno != EEXIST) return errno;
+            dir[i] = saved;
+        }
+        return 0;
+    }
+
+    // utime + stime (fields 14-15) and the CPU last run on (field 39)
+    static bool parseCpuUsage(const char* buf, unsigned long long& cpuTime, int& processor) {
+        const char* p = std::strrchr(buf, ')');
+        if (!p) return false;
+        ++p;
+        cpuTime = 0;
+        for (int field = 3; field <= 39; ++field) {
+            while (*p == ' ') ++p;
+            if (*p == '\0') return false;
+            if (field == 14 || field == 15) cpuTime += std::strtoull(p, nullptr, 10);
+            if (field == 39) processor = static_cast<int>(std::strtol(p, nullptr, 10));
+            while (*p && *p != ' ') ++p;
+        }
+        return true;
+    }
+
+    static bool parseStat(const char* buf, ProcStat& out) {
+        // comm may contain spaces and parentheses, so bracket it by the last ')'
+        const char* open = std::strchr(buf, '(');
+        const char* close = std::strrchr(buf, ')');
+        if (!open || !close || close < open) return false;
+
+        size_t len = std::min<size_t>(close - open - 1, COMM_LEN - 1);
+        std::memcpy(out.comm, open + 1, len);
+        out.comm[len] = '\0';
+
+        // Field 3 (state) follows ") "
+        const char* p = close + 1;
+        for (int field = 3; field <= 22; ++field) {
+            while (*p == ' ') ++p;
+            if (*p == '\0') return false;
+            char* end = nullptr;
+            switch (field) {
+                case 3: out.state = *p; break;
+                case 4: out.ppid = static_cast<pid_t>(std::strtol(p, &end, 10)); break;
+                case 5: out.pgrp = static_cast<pid_t>(std::strtol(p, &end, 10)); break;
+                case 9: out.flags = static_cast<unsigned int>(std::strtoul(p, &end, 10)); break;
+                case 14:
+                case 15: out.cpuTime += std::strtoull(p, &end, 10); break;
+                case 22: out.startTime = std::strtoull(p, &end, 10); break;
+                default: break;
+            }
+            while (*p && *p != ' ') ++p;
+        }
+        return true;
+    }
+
+    static constexpr pid_t KTHREADD_PID = 2;
+    static constexpr unsigned int PF_KTHREAD = 0x00200000;
+    static constexpr unsigned int PF_NO_SETAFFINITY = 0x04000000;
+
+    // Number of CPUs in Cpus_allowed_list of /proc/<pid>/status, or -1
+    static int allowedCpuCount(pid_t pid) {
+        char path[48];
+        char buf[4096];
+        std::snprintf(path, sizeof(path), "/proc/%d/status", pid);
+        if (readFile(path, buf, sizeof(buf)) <= 0) return -1;
+
+        const char* p = std::strstr(buf, "Cpus_allowed_list:");
+        if (!p) return -1;
+        p += std::strlen("Cpus_allowed_list:");
+
+        int count = 0;
+        while (*p && *p != '\n') {
+            while (*p == ' ' || *p == '\t' || *p == ',') ++p;
+            if (*p < '0' || *p > '9') break;
+            char* end = nullptr;
+            long first = std::strtol(p, &end, 10);
+            long last = first;
+            if (*end == '-') last = std::strtol(end + 1, &end, 10);
+            count += static_cast<int>(last - first + 1);
+            p = end;
+        }
+        return count;
+    }
+
+    // Bound threads reject sched_setaffinity with EINVAL: anything flagged
+    // PF_NO_SETAFFINITY (per-CPU kworkers, ksoftirqd, ...) and kthreads
+    // pinned to a single CPU with kthread_bind()
+    static bool isBound(pid_t tid, const ProcStat& st, bool kthread) {
+        if (st.flags & PF_NO_SETAFFINITY) return true;
+        return kthread && allowedCpuCount(tid) == 1;
+    }
+
+    static bool isKernelThread(pid_t pid, const ProcStat& st) {
+        return (st.flags & PF_KTHREAD) || pid == KTHREADD_PID || st.ppid == KTHREADD_PID;
+    }
+
+    static bool readStat(const char* path, ProcStat& out) {
+        char buf[512];
+        return readFile(path, buf, sizeof(buf)) > 0 && parseStat(buf, out);
+    }
+
+    // Invokes fn(pid_t) for every numeric entry of a /proc directory.
+    // Uses getdents64 on a stack buffer; opendir() would malloc per call.
+    template <typename Fn>
+    static void forEachNumericEntry(const char* dirPath, Fn&& fn) {
+        int fd = open(dirPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) return;
+
+        alignas(8) char buf[4096];
+        for (;;) {
+            long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+            if (n <= 0) break;
+            for (long off = 0; off < n;) {
+                auto* entry = reinterpret_cast<const LinuxDirent64*>(buf + off);
+                off += entry->d_reclen;
+
+                const char* name = entry->d_name;
+                if (*name < '1' || *name > '9') continue;
+                pid_t id = 0;
+                for (; *name >= '0' && *name <= '9'; ++name) id = id * 10 + (*name - '0');
+                if (*name == '\0') fn(id);
+            }
+        }
+        close(fd);
+    }
+
+    // Invokes fn(const char* name) for every subdirectory except . and ..
+    template <typename Fn>
+    static void forEachSubdirectory(const char* dirPath, Fn&& fn) {
+        int fd = open(dirPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) return;
+
+        alignas(8) char buf[4096];
+        for (;;) {
+            long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+            if (n <= 0) break;
+            for (long off = 0; off < n;) {
+                auto* entry = reinterpret_cast<const LinuxDirent64*>(buf + off);
+                off += entry->d_reclen;
+                if (entry->d_type != DT_DIR || entry->d_name[0] == '.') continue;
+                fn(static_cast<const char*>(entry->d_name));
+            }
+        }
+        close(fd);
+    }
+
+private:
+    struct LinuxDirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[256];
+    };
+};
+
+// Identity of a task that survives pid reuse: tid plus start time
+// (stat field 22). A recycled tid gets a later start time, so a cached
+// TaskId never matches the new task. Key for every per-task cache.
+struct TaskId {
+    pid_t tid = 0;
+    unsigned long long startTime = 0;
+
+    bool operator==(const TaskId& other) const {
+        return tid == other.tid && startTime == other.startTime;
+    }
+    bool operator!=(const TaskId& other) const { return !(*this == other); }
+
+    // Identity of whichever task owns tid right now
+    static bool read(pid_t tid, TaskId& out) {
+        char path[32];
+        std::snprintf(path, sizeof(path), "/proc/%d/stat", tid);
+        ProcessUtils::ProcStat stat;
+        if (!ProcessUtils::readStat(path, stat)) return false;
+        out = TaskId{tid, stat.startTime};
+        return true;
+    }
+
+    // True while the original task still owns the tid
+    bool alive() const {
+        TaskId current;
+        return read(tid, current) && current == *this;
+    }
+};
+
+struct TaskIdHash {
+    size_t operator()(const TaskId& id) const noexcept {
+        return std::hash<uint64_t>()((static_cast<uint64_t>(id.tid) << 40) ^ id.startTime);
+    }
+};
+
+// Cpusets owned by the optimizer, one per core set. Writing a pid to
+// cgroup.procs moves its whole thread group, and the move resets each
+// thread's affinity to the cpuset, so one write replaces a
+// sched_setaffinity per thread.
+class CpusetGroups {
+private:
+    static constexpr const char* ROOT = "/dev/cpuset";
+    static constexpr size_t DIR_SIZE = 320; // fits a CPU_SETSIZE-bit name
+
+    // Android mounts cpuset with noprefix; upstream layouts use "cpuset."
+    static int writeControl(const char* dir, const char* name, const char* data) {
+        char path[DIR_SIZE + 32];
+        std::snprintf(path, sizeof(path), "%s/%s", dir, name);
+        int err = ProcessUtils::writeFile(path, data, std::strlen(data));
+        if (err != ENOENT) return err;
+        std::snprintf(path, sizeof(path), "%s/cpuset.%s", dir, name);
+        return ProcessUtils::writeFile(path, data, std::strlen(data));
+    }
+
+    static bool readControl(const char* dir, const char* name, char* buf, size_t size) {
+        char path[DIR_SIZE + 32];
+        std::snprintf(path, sizeof(path), "%s/%s", dir, name);
+        if (ProcessUtils::readFile(path, buf, size) > 0) return true;
+        std::snprintf(path, sizeof(path), "%s/cpuset.%s", dir, name);
+        return ProcessUtils::readFile(path, buf, size) > 0;
+    }
+
+    static int create(const char* dir, const cpu_set_t& mask) {
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) return errno;
+
+        char cpus[256];
+        size_t len = 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE && len + 8 < sizeof(cpus); ++cpu) {
+            if (!CPU_ISSET(cpu, &mask)) continue;
+            len += std::snprintf(cpus + len, sizeof(cpus) - len, len ? ",%d" : "%d", cpu);
+        }
+        if (len == 0) return EINVAL;
+        if (int err = writeControl(dir, "cpus", cpus)) return err;
+
+        // cgroup v1 rejects attaching tasks until mems is populated
+        char mems[64];
+        if (!readControl(ROOT, "mems", mems, sizeof(mems))) return ENOENT;
+        return writeControl(dir, "mems", mems);
+    }
+
+    // Directory of the cpuset for mask, named by the whole mask in hex with
+    // the highest 64-bit word first (plain %llx up to 64 CPUs), so wide
+    // masks that share their low bits get groups of their own
+    static void dirOf(const cpu_set_t& mask, char* dir) {
+        constexpr int WORDS = CPU_SETSIZE / 64;
+        unsigned long long words[WORDS] = {};
+        int top = 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (!CPU_ISSET(cpu, &mask)) continue;
+            words[cpu / 64] |= 1ULL << (cpu % 64);
+            top = cpu / 64;
+        }
+        size_t len = std::snprintf(dir, DIR_SIZE, "%s/task_optimizer_", ROOT);
+        for (int word = top; word >= 0; --word) {
+            len += std::snprintf(dir + len, DIR_SIZE - len, word == top ? "%llx" : "%016llx", words[word]);
+        }
+    }
+
+    // Writes id to the given membership file of the optimizer's cpuset for mask
+    static int attach(pid_t id, const cpu_set_t& mask, const char* file) {
+        // Created lazily per distinct mask; a failed creation is kept for
+        // CPUSET_RETRY_MS, then tried again
+        struct Group {
+            cpu_set_t mask;
+            int err; // 0 ready, -1 not created yet, else the creation errno
+            std::chrono::steady_clock::time_point failed;
+        };
+        static std::vector<Group> groups;
+
+        char dir[DIR_SIZE];
+        dirOf(mask, dir);
+
+        const auto now = std::chrono::steady_clock::now();
+        auto it = std::find_if(groups.begin(), groups.end(),
+                               [&](const Group& group) { return CPU_EQUAL(&group.mask, &mask); });
+        if (it == groups.end()) {
+            groups.push_back(Group{mask, -1, now});
+            it = groups.end() - 1;
+        }
+        if (it->err < 0 ||
+            (it->err > 0 && now - it->failed >= std::chrono::milliseconds(config::CPUSET_RETRY_MS))) {
+            it->err = create(dir, mask);
+            it->failed = now;
+        }
+        if (it->err) return it->err;
+
+        char idStr[16];
+        std::snprintf(idStr, sizeof(idStr), "%d", id);
+        char path[DIR_SIZE + 32];
+        std::snprintf(path, sizeof(path), "%s/%s", dir, file);
+        return ProcessUtils::writeFile(path, idStr, std::strlen(idStr));
+    }
+
+public:
+    // Moves every thread of pid into the optimizer's cpuset for this mask
+    static int attachProcess(pid_t pid, const cpu_set_t& mask) {
+        return attach(pid, mask, "cgroup.procs");
+    }
+
+    // Moves a single thread (cgroup v1 "tasks" file)
+    static int attachThread(pid_t tid, const cpu_set_t& mask) {
+        return attach(tid, mask, "tasks");
+    }
+
+    // The cpuset path of tid relative to the root, from /proc/<tid>/cpuset
+    static bool pathOf(pid_t tid, char* path, size_t size) {
+        char procPath[32];
+        std::snprintf(procPath, sizeof(procPath), "/proc/%d/cpuset", tid);
+        char buf[128];
+        if (ProcessUtils::readFile(procPath, buf, sizeof(buf)) <= 0 || buf[0] != '/') return false;
+        const size_t len = std::strcspn(buf, "\n");
+        return std::snprintf(path, size, "%.*s", static_cast<int>(len), buf) <
+               static_cast<int>(size);
+    }
+
+    // Moves tid back into the cpuset at path (as returned by pathOf). Falls
+    // back to cgroup.procs, which moves the whole thread group, where the
+    // hierarchy has no per-thread "tasks" file.
+    static int moveThread(pid_t tid, const char* path) {
+        char idStr[16];
+        std::snprintf(idStr, sizeof(idStr), "%d", tid);
+        char file[128];
+        std::snprintf(file, sizeof(file), "%s%s/tasks", ROOT, path);
+        int err = ProcessUtils::writeFile(file, idStr, std::strlen(idStr));
+        if (err != ENOENT) return err;
+        std::snprintf(file, sizeof(file), "%s%s/cgroup.procs", ROOT, path);
+        return ProcessUtils::writeFile(file, idStr, std::strlen(idStr));
+    }
+
+    // Removes the optimizer's cpusets; ones still holding tasks stay
+    static void removeAll() {
+        std::vector<std::string> names;
+        ProcessUtils::forEachSubdirectory(ROOT, [&](const char* name) {
+            if (std::strncmp(name, "task_optimizer_", 15) == 0) names.emplace_back(name);
+        });
+        for (const auto& name : names) {
+            char dir[DIR_SIZE];
+            std::snprintf(dir, sizeof(dir), "%s/%s", ROOT, name.c_str());
+            rmdir(dir);
+        }
+    }
+};
+
+// A process's own cgroup v2 group. Controls are written only when the
+// process is alone in it (Android's uid_*/pid_* layout), so one rule never
+// throttles unrelated processes sharing the group.
+class OwnCgroup {
+private:
+    static constexpr const char* ROOT = "/sys/fs/cgroup";
+
+    // From the "0::" line of /proc/<pid>/cgroup
+    static bool dirOf(pid_t pid, char* dir, size_t size) {
+        char path[32];
+        char buf[1024];
+        std::snprintf(path, sizeof(path), "/proc/%d/cgroup", pid);
+        if (ProcessUtils::readFile(path, buf, sizeof(buf)) <= 0) return false;
+        const char* line = std::strncmp(buf, "0::", 3) == 0 ? buf : std::strstr(buf, "\n0::");
+        if (!line) return false;
+        line += line == buf ? 3 : 4;
+        const size_t len = std::strcspn(line, "\n");
+        return std::snprintf(dir, size, "%s%.*s", ROOT, static_cast<int>(len), line) <
+               static_cast<int>(size);
+    }
+
+public:
+    // Reads a control file of pid's group without the newline; false
+    // without cgroup v2, the controller, or when it does not fit
+    static bool read(pid_t pid, const char* control, char* buf, size_t size) {
+        char dir[256];
+        if (!Sanitizer::isValidPID(pid) || !dirOf(pid, dir, sizeof(dir))) return false;
+        char path[288];
+        std::snprintf(path, sizeof(path), "%s/%s", dir, control);
+        const ssize_t len = ProcessUtils::readFile(path, buf, size);
+        if (len <= 0 || static_cast<size_t>(len) + 1 >= size) return false;
+        buf[std::strcspn(buf, "\n")] = '\0';
+        return true;
+    }
+
+    // Writes data to a control file of pid's group; EBUSY when the group
+    // is shared, ENOENT without cgroup v2 or the controller
+    static int write(pid_t pid, const char* control, const char* data) {
+        if (!Sanitizer::isValidPID(pid)) return ESRCH;
+        char dir[256];
+        if (!dirOf(pid, dir, sizeof(dir))) return ENOENT;
+
+        char path[288];
+        char buf[64];
+        std::snprintf(path, sizeof(path), "%s/cgroup.procs", dir);
+        if (ProcessUtils::readFile(path, buf, sizeof(buf)) <= 0) return ENOENT;
+        char* end = nullptr;
+        if (std::strtol(buf, &end, 10) != pid || *end != '\n' || end[1] != '\0') return EBUSY;
+
+        std::snprintf(path, sizeof(path), "%s/%s", dir, control);
+        return ProcessUtils::writeFile(path, data, std::strlen(data));
+    }
+
+    // Proportional I/O weight (1-1000): BFQ's io.bfq.weight when BFQ
+    // schedules the disk, else blk-cgroup's io.weight (iocost)
+    static int setIOWeight(pid_t pid, int weight) {
+        char data[16];
+        std::snprintf(data, sizeof(data), "%d", weight);
+        const int err = write(pid, "io.bfq.weight", data);
+        return err == ENOENT ? write(pid, "io.weight", data) : err;
+    }
+
+    // Default weight line ("default 100") of the file setIOWeight would
+    // write; bfq tells which one it was
+    static bool getIOWeight(pid_t pid, char* buf, size_t size, bool& bfq) {
+        char data[256]; // room for per-device lines after the default
+        bfq = read(pid, "io.bfq.weight", data, sizeof(data));
+        if (!bfq && !read(pid, "io.weight", data, sizeof(data))) return false;
+        const size_t len = std::strlen(data);
+        if (len + 1 > size) return false;
+        std::memcpy(buf, data, len + 1);
+        return true;
+    }
+
+    static int setIOWeight(pid_t pid, const char* value, bool bfq) {
+        return write(pid, bfq ? "io.bfq.weight" : "io.weight", value);
+    }
+};
+
+// Process-wide memory controls: OOM killer preference, cgroup v2
+// memory.high and proactive reclaim through process_madvise(2)
+class MemoryPolicy {
+private:
+    static constexpr size_t MADVISE_BATCH = 64; // iovecs per call, well under UIO_MAXIOV
+
+#ifdef SYS_process_madvise
+    static int advise(int pidfd, const iovec* ranges, size_t count, int advice, size_t& advised) {
+        const long n = syscall(SYS_process_madvise, pidfd, ranges, count, advice, 0);
+        if (n < 0) return errno == ENOMEM ? 0 : errno; // a range unmapped since maps was read
+        advised += static_cast<size_t>(n);
+        return 0;
+    }
+#endif
+
+public:
+    static bool getOomScoreAdj(pid_t pid, int& value) {
+        char path[40];
+        char data[16];
+        std::snprintf(path, sizeof(path), "/proc/%d/oom_score_adj", pid);
+        if (ProcessUtils::readFile(path, data, sizeof(data)) <= 0) return false;
+        value = static_cast<int>(std::strtol(data, nullptr, 10));
+        return true;
+    }
+
+    static int setOomScoreAdj(pid_t pid, int value) {
+        if (!Sanitizer::isValidPID(pid)) return ESRCH;
+        char path[40];
+        char data[16];
+        std::snprintf(path, sizeof(path), "/proc/%d/oom_score_adj", pid);
+        const int len = std::snprintf(data, sizeof(data), "%d", value);
+        return ProcessUtils::writeFile(path, data, static_cast<size_t>(len));
+    }
+
+    static int setMemoryHigh(pid_t pid, long long bytes) {
+        char data[24];
+        std::snprintf(data, sizeof(data), "%lld", bytes);
+        return setMemoryHigh(pid, data);
+    }
+
+    // Text as read from memory.high: bytes or "max"
+    static int setMemoryHigh(pid_t pid, const char* value) {
+        return OwnCgroup::write(pid, "memory.high", value);
+    }
+
+    // Advises the private writable mappings of a process (heap, anonymous,
+    // stack, .data) in MADVISE_BATCH ranges per call. The pidfd pins the
+    // process, so the identity check after opening it rules out pid reuse.
+    // Adds the bytes advised to advised; returns 0 or errno.
+    static int reclaim(const TaskId& id, int advice, size_t& advised) {
+#ifdef SYS_process_madvise
+        const int pidfd = static_cast<int>(syscall(SYS_pidfd_open, id.tid, 0));
+        if (pidfd < 0) return errno;
+        if (!id.alive()) {
+            close(pidfd);
+            return ESRCH;
+        }
+        char path[32];
+        std::snprintf(path, sizeof(path), "/proc/%d/maps", id.tid);
+        const int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            const int err = errno;
+            close(pidfd);
+            return err;
+        }
+
+        char buf[4096];
+        size_t len = 0;
+        iovec ranges[MADVISE_BATCH];
+        size_t count = 0;
+        int err = 0;
+        ssize_t n;
+        while (!err && (n = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0) {
+            len += static_cast<size_t>(n);
+            buf[len] = '\0';
+            char* line = buf;
+            for (char* nl; !err && (nl = std::strchr(line, '\n')); line = nl + 1) {
+                // "start-end perms offset dev inode [path]"
+                char* p = nullptr;
+                const unsigned long long start = std::strtoull(line, &p, 16);
+                const unsigned long long end = std::strtoull(p + 1, &p, 16);
+                if (p[0] != ' ' || p[2] != 'w' || p[4] != 'p' || end <= start) continue;
+                ranges[count].iov_base = reinterpret_cast<void*>(start);
+                ranges[count].iov_len = static_cast<size_t>(end - start);
+                if (++count == MADVISE_BATCH) {
+                    err = advise(pidfd, ranges, count, advice, advised);
+                    count = 0;
+                }
+            }
+            len = static_cast<size_t>(buf + len - line);
+            std::memmove(buf, line, len);
+            if (len + 1 >= sizeof(buf)) len = 0; // overlong line, skip it
+        }
+        if (!err && count) err = advise(pidfd, ranges, count, advice, advised);
+        close(fd);
+        close(pidfd);
+        return err;
+#else
+        (void)id;
+        (void)advice;
+        (void)advised;
+        return ENOSYS;
+#endif
+    }
+};
+
+// Hard IRQs listed in /proc/interrupts and their /proc/irq/<n> affinity
+class Interrupts {
+private:
+    // Per-CPU count columns, from the "CPU0 CPU1 ..." header
+    static int countColumns(const char* header) {
+        int columns = 0;
+        for (const char* p = header; (p = std::strstr(p, "CPU")); p += 3) ++columns;
+        return columns;
+    }
+
+    // Trigger type, either its own token (Edge/Level) or a hwirq suffix
+    // (458752-edge); the action names follow it
+    static bool isTrigger(std::string_view token) {
+        auto endsWith = [&](std::string_view suffix) {
+            return token.size() >= suffix.size() && token.substr(token.size() - suffix.size()) == suffix;
+        };
+        return token == "Edge" || token == "Level" || endsWith("-edge") || endsWith("-level");
+    }
+
+public:
+    // Calls fn(irq, names) for each numbered IRQ, where names is the action
+    // list ("fts_ts" or "a, b" on shared lines). Architecture rows (NMI,
+    // LOC, IPI...) are skipped. Returns false if the file is unreadable.
+    template <typename Fn>
+    static bool forEach(Fn&& fn) {
+        static char text[131072];
+        int fd = open("/proc/interrupts", O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        size_t len = 0;
+        ssize_t n;
+        while (len + 1 < sizeof(text) && (n = read(fd, text + len, sizeof(text) - 1 - len)) > 0) {
+            len += static_cast<size_t>(n);
+        }
+        close(fd);
+        text[len] = '\0';
+
+        char* save = nullptr;
+        const char* header = strtok_r(text, "\n", &save);
+        if (!header) return true;
+        const int columns = countColumns(header);
+
+        for (char* line = strtok_r(nullptr, "\n", &save); line; line = strtok_r(nullptr, "\n", &save)) {
+            char* p = nullptr;
+            const long irq = std::strtol(line, &p, 10);
+            if (p == line || *p != ':') continue;
+            ++p;
+            for (int column = 0; column < columns; ++column) std::strtoul(p, &p, 10);
+
+            // Chip, hwirq and trigger precede the names; without a trigger
+            // column the last token is taken as the name
+            const char* names = nullptr;
+            const char* last = nullptr;
+            for (char* token = p; *token;) {
+                while (*token == ' ') ++token;
+                if (!*token) break;
+                char* end = token + std::strcspn(token, " ");
+                if (isTrigger(std::string_view(token, static_cast<size_t>(end - token)))) names = end;
+                else last = token;
+                token = end;
+            }
+            if (names) {
+                while (*names == ' ') ++names;
+            } else {
+                names = last;
+            }
+            if (names && *names) fn(static_cast<int>(irq), names);
+        }
+        return true;
+    }
+
+    // smp_affinity_list as the kernel prints it ("0-3"), without the newline
+    static bool getAffinity(int irq, char* list, size_t size) {
+        char path[48];
+        std::snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irq);
+        if (ProcessUtils::readFile(path, list, size) <= 0) return false;
+        list[std::strcspn(list, "\n")] = '\0';
+        return list[0] != '\0';
+    }
+
+    // Fails with EIO for per-CPU and kernel-managed IRQs
+    static int setAffinity(int irq, const char* list) {
+        char path[48];
+        std::snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irq);
+        return ProcessUtils::writeFile(path, list, std::strlen(list));
+    }
+
+    static int setAffinity(int irq, const cpu_set_t& mask) {
+        char cpus[256];
+        return setAffinity(irq, CPUTopology::formatMask(mask, cpus, sizeof(cpus)));
+    }
+};
+
+// Unbound workqueues registered with WQ_SYSFS. Their workers come and go,
+// but cpumask and nice set here apply to every worker the pool spawns.
+class Workqueues {
+private:
+    static constexpr const char* ROOT = "/sys/devices/virtual/workqueue";
+    // ROOT, a d_name of up to 255 bytes and the attribute name
+    static constexpr size_t PATH_LEN = 320;
+
+    static bool attrPath(char (&path)[PATH_LEN], const char* name, const char* attr) {
+        return std::snprintf(path, PATH_LEN, "%s/%s/%s", ROOT, name, attr) <
+               static_cast<int>(PATH_LEN);
+    }
+
+    static int writeAttr(const char* name, const char* attr, const char* data) {
+        char path[PATH_LEN];
+        if (!attrPath(path, name, attr)) return ENAMETOOLONG;
+        return ProcessUtils::writeFile(path, data, std::strlen(data));
+    }
+
+public:
+    // Attribute text without the newline; false if unreadable or it
+    // does not fit
+    static bool readAttr(const char* name, const char* attr, char* buf, size_t size) {
+        char path[PATH_LEN];
+        if (!attrPath(path, name, attr)) return false;
+        const ssize_t len = ProcessUtils::readFile(path, buf, size);
+        if (len <= 0 || static_cast<size_t>(len) + 1 >= size) return false;
+        buf[std::strcspn(buf, "\n")] = '\0';
+        return true;
+    }
+
+    // Calls fn(name) per tunable workqueue; per-CPU ones have no nice file
+    template <typename Fn>
+    static void forEach(Fn&& fn) {
+        ProcessUtils::forEachSubdirectory(ROOT, [&](const char* name) {
+            char path[PATH_LEN];
+            if (attrPath(path, name, "nice") && access(path, W_OK) == 0) fn(name);
+        });
+    }
+
+    // cpumask takes a hex bitmap in comma-separated 32-bit words, "ff,000000f0"
+    static int setCpumask(const char* name, const cpu_set_t& mask) {
+        char hex[160];
+        size_t len = 0;
+        int top = CPU_SETSIZE - 1;
+        while (top > 0 && !CPU_ISSET(top, &mask)) --top;
+        for (int word = top / 32; word >= 0 && len < sizeof(hex); --word) {
+            uint32_t bits = 0;
+            for (int bit = 0; bit < 32; ++bit) {
+                if (CPU_ISSET(word * 32 + bit, &mask)) bits |= uint32_t{1} << bit;
+            }
+            const bool first = len == 0;
+            len += std::snprintf(hex + len, sizeof(hex) - len, first ? "%x" : ",%08x", bits);
+        }
+        return writeAttr(name, "cpumask", hex);
+    }
+
+    // Hex bitmap as read back by readAttr
+    static int setCpumask(const char* name, const char* hex) {
+        return writeAttr(name, "cpumask", hex);
+    }
+
+    static int setNice(const char* name, int nice) {
+        char data[16];
+        std::snprintf(data, sizeof(data), "%d", nice);
+        return writeAttr(name, "nice", data);
+    }
+};
+
+#if TASK_OPTIMIZER_HAS_IO_URING
+// Minimal raw io_uring ring; only what the procfs reader needs
+class IoUring {
+private:
+    int ringFd = -1;
+    void* sqPtr = MAP_FAILED;
+    void* cqPtr = MAP_FAILED;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqSize = 0;
+    size_t cqSize = 0;
+    size_t sqesSize = 0;
+
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned pending = 0;
+
+public:
+    IoUring() = default;
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    ~IoUring() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+        if (cqPtr != MAP_FAILED && cqPtr != sqPtr) munmap(cqPtr, cqSize);
+        if (sqPtr != MAP_FAILED) munmap(sqPtr, sqSize);
+        if (ringFd >= 0) close(ringFd);
+    }
+
+    // Sets up the ring and a sparse table of direct file descriptors
+    bool init(unsigned entries, unsigned fileSlots) {
+        io_uring_params params{};
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ringFd < 0) return false;
+
+        sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMmap) sqSize = cqSize = std::max(sqSize, cqSize);
+
+        sqPtr = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ringFd, IORING_OFF_SQ_RING);
+        if (sqPtr == MAP_FAILED) return false;
+        cqPtr = singleMmap ? sqPtr
+                           : mmap(nullptr, cqSize, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqPtr == MAP_FAILED) return false;
+
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                                               MAP_SHARED | MAP_POPULATE, ringFd,
+                                               IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) return false;
+
+        auto* sq = static_cast<char*>(sqPtr);
+        auto* cq = static_cast<char*>(cqPtr);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        std::vector<int> files(fileSlots, -1);
+        return syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_FILES,
+                       files.data(), fileSlots) == 0;
+    }
+
+    io_uring_sqe* nextSqe() {
+        unsigned tail = *sqTail + pending;
+        unsigned index = tail & *sqMask;
+        sqArray[index] = index;
+        ++pending;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // Submits queued SQEs and invokes fn(cqe) until all of them completed.
+    // On false, SQEs the kernel never took are still queued, so the ring
+    // must be replaced rather than reused.
+    template <typename Fn>
+    bool submitAndReap(Fn&& fn) {
+        const unsigned total = pending;
+        __atomic_store_n(sqTail, *sqTail + pending, __ATOMIC_RELEASE);
+        pending = 0;
+
+        unsigned toSubmit = total;
+        unsigned reaped = 0;
+        while (reaped < total) {
+            int ret = static_cast<int>(syscall(__NR_io_uring_enter, ringFd, toSubmit,
+                                               total - reaped, IORING_ENTER_GETEVENTS,
+                                               nullptr, 0));
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                discard(total - toSubmit - reaped);
+                return false;
+            }
+            toSubmit -= std::min<unsigned>(toSubmit, static_cast<unsigned>(ret));
+
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head, ++reaped) {
+                fn(cqes[head & *cqMask]);
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+        return true;
+    }
+
+private:
+    // Waits out and drops the completions still owed for submitted SQEs,
+    // so none of them writes into a caller's buffer after a failed batch
+    void discard(unsigned inFlight) {
+        while (inFlight) {
+            unsigned head = *cqHead;
+            const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail && inFlight; ++head) --inFlight;
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            if (!inFlight) return;
+            if (syscall(__NR_io_uring_enter, ringFd, 0, inFlight, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+                errno != EINTR) {
+                return;
+            }
+        }
+    }
+};
+#endif
+
+// Batched /proc file reader. With io_uring each file is an openat -> read ->
+// close chain on a direct descriptor, so a batch costs one syscall; otherwise
+// files are read synchronously one by one.
+class ProcReader {
+public:
+    static constexpr size_t BATCH = 64;
+    static constexpr size_t PATH_SIZE = 64;
+    static constexpr size_t BUF_SIZE = 512;
+
+    ProcReader() {
+#if TASK_OPTIMIZER_HAS_IO_URING
+        ring = std::make_unique<IoUring>();
+        if (ring->init(BATCH * OPS_PER_FILE, BATCH)) {
+            std::snprintf(paths[0], PATH_SIZE, "/proc/self/stat");
+            readUring(1);
+            if (results[0] > 0) return;
+        }
+        ring.reset();
+        Logger::log("io_uring unavailable, using synchronous procfs reads");
+#endif
+    }
+
+    char* path(size_t i) { return paths[i]; }
+    const char* buffer(size_t i) const { return buffers[i]; }
+    ssize_t result(size_t i) const { return results[i]; }
+
+    // Reads the first n paths; result(i) is the byte count or -1
+    void readAll(size_t n) {
+#if TASK_OPTIMIZER_HAS_IO_URING
+        if (ring) {
+            readUring(n);
+            return;
+        }
+#endif
+        for (size_t i = 0; i < n; ++i) {
+            results[i] = ProcessUtils::readFile(paths[i], buffers[i], BUF_SIZE);
+        }
+    }
+
+private:
+    char paths[BATCH][PATH_SIZE] = {};
+    char buffers[BATCH][BUF_SIZE] = {};
+    ssize_t results[BATCH] = {};
+
+#if TASK_OPTIMIZER_HAS_IO_URING
+    static constexpr unsigned OPS_PER_FILE = 3;
+    std::unique_ptr<IoUring> ring;
+
+    void readUring(size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            results[i] = -1;
+            const auto slot = static_cast<unsigned>(i);
+            const uint64_t tag = static_cast<uint64_t>(i) * OPS_PER_FILE;
+
+            // A failed open cancels the chain; the read is hard-linked so
+            // the close still runs after a (normal) short read
+            io_uring_sqe* sqe = ring->nextSqe();
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = reinterpret_cast<uintptr_t>(paths[i]);
+            sqe->open_flags = O_RDONLY;
+            sqe->file_index = slot + 1;
+            sqe->flags = IOSQE_IO_LINK;
+            sqe->user_data = tag;
+
+            sqe = ring->nextSqe();
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = static_cast<int>(slot);
+            sqe->addr = reinterpret_cast<uintptr_t>(buffers[i]);
+            sqe->len = BUF_SIZE - 1;
+            sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+            sqe->user_data = tag + 1;
+
+            sqe = ring->nextSqe();
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->file_index = slot + 1;
+            sqe->user_data = tag + 2;
+        }
+
+        bool ok = ring->submitAndReap([this](const io_uring_cqe& cqe) {
+            if (cqe.user_data % OPS_PER_FILE != 1) return;
+            size_t i = cqe.user_data / OPS_PER_FILE;
+            if (cqe.res >= 0) {
+                buffers[i][cqe.res] = '\0';
+                results[i] = cqe.res;
+            }
+        });
+
+        if (!ok) {
+            // The old ring may still hold unsubmitted SQEs and occupied
+            // file slots; the next batch starts on a fresh one
+            ring = std::make_unique<IoUring>();
+            if (!ring->init(BATCH * OPS_PER_FILE, BATCH)) {
+                ring.reset();
+                Logger::log("io_uring failed, using synchronous procfs reads");
+            }
+            for (size_t i = 0; i < n; ++i) {
+                results[i] = ProcessUtils::readFile(paths[i], buffers[i], BUF_SIZE);
+            }
+        }
+    }
+#endif
+};
+
+// Persistent tid-keyed task table; each rescan yields the delta against the previous one
+class ProcessTable {
+public:
+    struct Entry {
+        pid_t tid = 0; // 0 marks an empty slot
+        pid_t tgid = 0;
+        pid_t pgid = 0;
+        unsigned long long startTime = 0;
+        uint64_t ruleMask = 0; // rules matched by the owning process
+        uint32_t generation = 0;
+        bool kthread = false;
+        bool bound = false; // affinity is fixed by the kernel
+        char comm[ProcessUtils::COMM_LEN] = {};
+
+        TaskId id() const { return TaskId{tid, startTime}; }
+    };
+
+    // Only managed entries (ruleMask != 0) are reported. Within appeared and
+    // renamed, a process leader is immediately followed by its threads.
+    struct Diff {
+        std::vector<Entry> appeared;
+        std::vector<Entry> renamed; // renamed leaders with their threads, or lone renamed threads
+        std::vector<Entry> exited; // gone, recycled, or no longer matched
+
+        bool empty() const { return appeared.empty() && renamed.empty() && exited.empty(); }
+        void clear() { appeared.clear(); renamed.clear(); exited.clear(); }
+    };
+
+    ProcessTable() : slots(INITIAL_CAPACITY) {}
+
+    size_t size() const { return count; }
+
+    // Copies every managed entry into out, each thread group contiguous
+    // with its leader first, ready for the apply stage
+    void collectManaged(std::vector<Entry>& out) const {
+        out.clear();
+        for (const auto& entry : slots) {
+            if (entry.tid != 0 && entry.ruleMask) out.push_back(entry);
+        }
+        std::sort(out.begin(), out.end(), [](const Entry& a, const Entry& b) {
+            if (a.tgid != b.tgid) return a.tgid < b.tgid;
+            if ((a.tid == a.tgid) != (b.tid == b.tgid)) return a.tid == a.tgid;
+            return a.tid < b.tid;
+        });
+    }
+
+    // Entry for a task, or nullptr if it is gone or its tid was recycled
+    const Entry* lookup(const TaskId& id) const {
+        for (size_t i = home(id.tid);; i = (i + 1) & (slots.size() - 1)) {
+            if (slots[i].tid == id.tid) return slots[i].startTime == id.startTime ? &slots[i] : nullptr;
+            if (slots[i].tid == 0) return nullptr;
+        }
+    }
+
+    // Forgets every entry; the next rescan reports all tasks as appeared
+    void reset() {
+        std::fill(slots.begin(), slots.end(), Entry{});
+        count = 0;
+    }
+
+    size_t kernelThreadCount() const { return kthreads.size(); }
+    bool kernelThreadsIndexed() const { return kthreadIndexValid; }
+
+    // True when pid leads a process group with no other member processes,
+    // so PRIO_PGRP / IOPRIO_WHO_PGRP calls reach exactly its threads
+    bool isSoleGroupLeader(pid_t pid, pid_t pgid) const {
+        if (pid != pgid) return false;
+        auto range = std::equal_range(groupIds.begin(), groupIds.end(), pgid);
+        return range.second - range.first == 1;
+    }
+
+    // match(comm) returns the rule mask for a process name. Threads are only
+    // enumerated for processes that match at least one rule.
+    template <typename Matcher>
+    const Diff& rescan(Matcher&& match) {
+        diff.clear();
+        ++generation;
+
+        pids.clear();
+        groupIds.clear();
+        const bool indexed = loadKernelThreads();
+        ProcessUtils::forEachNumericEntry("/proc", [&](pid_t pid) {
+            if (indexed && restampKernelThread(pid)) return;
+            pids.push_back(pid);
+        });
+
+        ProcessUtils::ProcStat stats[ProcReader::BATCH];
+        bool valid[ProcReader::BATCH];
+        for (size_t base = 0; base < pids.size(); base += ProcReader::BATCH) {
+            const size_t n = std::min(ProcReader::BATCH, pids.size() - base);
+            for (size_t i = 0; i < n; ++i) {
+                std::snprintf(reader.path(i), ProcReader::PATH_SIZE, "/proc/%d/stat", pids[base + i]);
+            }
+            reader.readAll(n);
+
+            // Parse the whole batch first; thread scans below reuse the reader
+            for (size_t i = 0; i < n; ++i) {
+                stats[i] = ProcessUtils::ProcStat{};
+                valid[i] = reader.result(i) > 0 && ProcessUtils::parseStat(reader.buffer(i), stats[i]);
+            }
+            for (size_t i = 0; i < n; ++i) {
+                if (!valid[i]) continue;
+                groupIds.push_back(stats[i].pgrp);
+                scanProcess(pids[base + i], stats[i], match);
+            }
+        }
+
+        std::sort(groupIds.begin(), groupIds.end());
+        sweep();
+        return diff;
+    }
+
+    // Targeted update for the given thread-group leaders only. Nothing is
+    // swept, so the diff never reports exits; the next rescan() does.
+    // groupIds follow the leaders' process groups, but keep those of
+    // exited processes until then, which only makes isSoleGroupLeader
+    // more cautious.
+    template <typename Matcher>
+    const Diff& refresh(const pid_t* leaders, size_t n, Matcher&& match) {
+        diff.clear();
+        for (size_t base = 0; base < n; base += ProcReader::BATCH) {
+            const size_t count = std::min(ProcReader::BATCH, n - base);
+            ProcessUtils::ProcStat stats[ProcReader::BATCH];
+            bool valid[ProcReader::BATCH];
+            for (size_t i = 0; i < count; ++i) {
+                std::snprintf(reader.path(i), ProcReader::PATH_SIZE, "/proc/%d/stat", leaders[base + i]);
+            }
+            reader.readAll(count);
+            for (size_t i = 0; i < count; ++i) {
+                valid[i] = reader.result(i) > 0 && ProcessUtils::parseStat(reader.buffer(i), stats[i]);
+            }
+            for (size_t i = 0; i < count; ++i) {
+                if (!valid[i]) continue;
+                moveGroup(leaders[base + i], stats[i]);
+                scanProcess(leaders[base + i], stats[i], match);
+            }
+        }
+        return diff;
+    }
+
+private:
+    static constexpr size_t INITIAL_CAPACITY = 1024; // power of two
+    static constexpr const char* KTHREAD_CHILDREN = "/proc/2/task/2/children";
+
+    std::vector<Entry> slots;
+    // Per-scan scratch; cleared but never shrunk, so a warmed-up rescan
+    // runs without heap allocations
+    std::vector<pid_t> pids;
+    std::vector<pid_t> threadIds;
+    std::vector<pid_t> stale;
+    std::vector<pid_t> groupIds; // pgrp of every live process, sorted after a scan
+    std::vector<pid_t> kthreads; // kthreadd children, sorted
+    std::vector<char> childrenBuf;
+    bool kthreadIndexValid = false;
+    ProcReader reader;
+    Diff diff;
+    size_t count = 0;
+    uint32_t generation = 0;
+
+    size_t home(pid_t tid) const {
+        return (static_cast<uint32_t>(tid) * 2654435761u) & (slots.size() - 1);
+    }
+
+    Entry* find(pid_t tid) {
+        for (size_t i = home(tid);; i = (i + 1) & (slots.size() - 1)) {
+            if (slots[i].tid == tid) return &slots[i];
+            if (slots[i].tid == 0) return nullptr;
+        }
+    }
+
+    Entry& insert(const Entry& entry) {
+        if ((count + 1) * 10 > slots.size() * 7) grow();
+        size_t i = home(entry.tid);
+        while (slots[i].tid != 0) i = (i + 1) & (slots.size() - 1);
+        slots[i] = entry;
+        slots[i].generation = generation;
+        ++count;
+        return slots[i];
+    }
+
+    // Backward-shift deletion keeps probe chains intact without tombstones
+    void erase(pid_t tid) {
+        const size_t mask = slots.size() - 1;
+        size_t i = home(tid);
+        while (slots[i].tid != tid) {
+            if (slots[i].tid == 0) return;
+            i = (i + 1) & mask;
+        }
+        slots[i] = Entry{};
+        --count;
+
+        for (size_t j = (i + 1) & mask; slots[j].tid != 0; j = (j + 1) & mask) {
+            size_t k = home(slots[j].tid);
+            bool inRange = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+            if (inRange) continue;
+            slots[i] = slots[j];
+            slots[j] = Entry{};
+            i = j;
+        }
+    }
+
+    void grow() {
+        std::vector<Entry> old(slots.size() * 2);
+        old.swap(slots);
+        count = 0;
+        for (const auto& entry : old) {
+            if (entry.tid == 0) continue;
+            size_t i = home(entry.tid);
+            while (slots[i].tid != 0) i = (i + 1) & (slots.size() - 1);
+            slots[i] = entry;
+            ++count;
+        }
+    }
+
+    // Kernel threads are all children of kthreadd, so one read of its
+    // children list indexes them without touching each /proc/<pid>/stat.
+    // Needs CONFIG_PROC_CHILDREN; without it every pid is stat'd and
+    // kthreads are told apart by PF_KTHREAD / ppid instead.
+    bool loadKernelThreads() {
+        kthreads.clear();
+        int fd = open(KTHREAD_CHILDREN, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            kthreadIndexValid = false;
+            return false;
+        }
+
+        if (childrenBuf.size() < 16384) childrenBuf.resize(16384);
+        size_t len = 0;
+        for (;;) {
+            if (len == childrenBuf.size()) childrenBuf.resize(childrenBuf.size() * 2);
+            ssize_t n = read(fd, childrenBuf.data() + len, childrenBuf.size() - len);
+            if (n <= 0) break;
+            len += static_cast<size_t>(n);
+        }
+        close(fd);
+
+        pid_t value = 0;
+        for (size_t i = 0; i < len; ++i) {
+            char c = childrenBuf[i];
+            if (c >= '0' && c <= '9') {
+                value = value * 10 + (c - '0');
+            } else if (value) {
+                kthreads.push_back(value);
+                value = 0;
+            }
+        }
+        if (value) kthreads.push_back(value);
+
+        std::sort(kthreads.begin(), kthreads.end());
+        kthreadIndexValid = true;
+        return true;
+    }
+
+    // A pid still listed under kthreadd that we already know as a kernel
+    // thread is kept without re-reading its stat. Kernel threads never
+    // exec, so only a recycled pid could change it, and that would need
+    // kthreadd to hand the same pid to a new child between two scans.
+    // Kworkers are the exception: their comm follows the workqueue they
+    // serve (+name while running, -name once bound), so they are re-read.
+    bool restampKernelThread(pid_t pid) {
+        if (!std::binary_search(kthreads.begin(), kthreads.end(), pid)) return false;
+        Entry* entry = find(pid);
+        if (!entry || !entry->kthread || std::strncmp(entry->comm, "kworker/", 8) == 0) return false;
+        entry->generation = generation;
+        groupIds.push_back(entry->pgid);
+        return true;
+    }
+
+    // Moves a leader refresh() re-read to its current process group in
+    // groupIds, before scanProcess updates its pgid. An exec often comes
+    // right after setsid() or setpgid(), so the group may have changed.
+    void moveGroup(pid_t pid, const ProcessUtils::ProcStat& st) {
+        const Entry* known = find(pid);
+        if (known && known->startTime == st.startTime) {
+            if (known->pgid == st.pgrp) return;
+            auto it = std::lower_bound(groupIds.begin(), groupIds.end(), known->pgid);
+            if (it != groupIds.end() && *it == known->pgid) groupIds.erase(it);
+        }
+        groupIds.insert(std::upper_bound(groupIds.begin(), groupIds.end(), st.pgrp), st.pgrp);
+    }
+
+    template <typename Matcher>
+    void scanProcess(pid_t pid, const ProcessUtils::ProcStat& st, Matcher& match) {
+        bool appeared = false;
+        bool renamed = false;
+
+        Entry* leader = find(pid);
+        if (leader && leader->startTime != st.startTime) {
+            // pid was recycled since the last scan
+            if (leader->ruleMask) diff.exited.push_back(*leader);
+            leader = nullptr;
+            erase(pid);
+        }
+
+        if (!leader) {
+            Entry fresh;
+            fresh.tid = pid;
+            fresh.tgid = pid;
+            fresh.pgid = st.pgrp;
+            fresh.kthread = ProcessUtils::isKernelThread(pid, st);
+            fresh.startTime = st.startTime;
+            std::memcpy(fresh.comm, st.comm, sizeof(fresh.comm));
+            fresh.ruleMask = match(std::string_view(fresh.comm));
+            leader = &insert(fresh);
+            appeared = true;
+        } else if (std::strncmp(leader->comm, st.comm, sizeof(leader->comm)) != 0) {
+            std::memcpy(leader->comm, st.comm, sizeof(leader->comm));
+            uint64_t newMask = match(std::string_view(leader->comm));
+            if (leader->ruleMask && !newMask) diff.exited.push_back(*leader);
+            // A process that starts matching is new to the managed set
+            if (leader->ruleMask == 0) appeared = true;
+            else renamed = true;
+            leader->ruleMask = newMask;
+        }
+
+        leader->generation = generation;
+        leader->pgid = st.pgrp;
+        const uint64_t mask = leader->ruleMask;
+        if (!mask) return;
+
+        // Only managed tasks are classified; it may cost a status read
+        if (appeared || renamed) leader->bound = ProcessUtils::isBound(pid, st, leader->kthread);
+
+        if (appeared) diff.appeared.push_back(*leader);
+        else if (renamed) diff.renamed.push_back(*leader);
+
+        scanThreads(pid, st.pgrp, mask, appeared, renamed);
+    }
+
+    // stat is read for known threads too: a tid freed by an exited thread
+    // can be handed to a new thread of the same process between two scans,
+    // and only the start time tells them apart. Such a tid is reported as
+    // the old thread exiting and a new one appearing.
+    void scanThreads(pid_t pid, pid_t pgid, uint64_t mask, bool appeared, bool renamed) {
+        char path[ProcReader::PATH_SIZE];
+        std::snprintf(path, sizeof(path), "/proc/%d/task", pid);
+
+        threadIds.clear();
+        ProcessUtils::forEachNumericEntry(path, [&](pid_t tid) {
+            if (tid != pid) threadIds.push_back(tid);
+        });
+
+        for (size_t base = 0; base < threadIds.size(); base += ProcReader::BATCH) {
+            const size_t n = std::min(ProcReader::BATCH, threadIds.size() - base);
+            for (size_t i = 0; i < n; ++i) {
+                std::snprintf(reader.path(i), ProcReader::PATH_SIZE, "/proc/%d/task/%d/stat",
+                              pid, threadIds[base + i]);
+            }
+            reader.readAll(n);
+
+            for (size_t i = 0; i < n; ++i) {
+                const pid_t tid = threadIds[base + i];
+                ProcessUtils::ProcStat st;
+                if (reader.result(i) <= 0 || !ProcessUtils::parseStat(reader.buffer(i), st)) continue;
+
+                if (Entry* thread = find(tid)) {
+                    if (thread->tgid == pid && thread->startTime == st.startTime) {
+                        thread->generation = generation;
+                        thread->pgid = pgid;
+                        thread->ruleMask = mask;
+                        // Threads name themselves after they start (binder:N_M)
+                        const bool ownName = std::strncmp(thread->comm, st.comm, sizeof(thread->comm)) != 0;
+                        if (ownName) std::memcpy(thread->comm, st.comm, sizeof(thread->comm));
+                        if (appeared) diff.appeared.push_back(*thread);
+                        else if (renamed || ownName) diff.renamed.push_back(*thread);
+                        continue;
+                    }
+                    if (thread->ruleMask) diff.exited.push_back(*thread);
+                    erase(tid);
+                }
+
+                Entry fresh;
+                fresh.tid = tid;
+                fresh.tgid = pid;
+                fresh.pgid = pgid;
+                fresh.startTime = st.startTime;
+                fresh.ruleMask = mask;
+                fresh.bound = st.flags & ProcessUtils::PF_NO_SETAFFINITY;
+                std::memcpy(fresh.comm, st.comm, sizeof(fresh.comm));
+                diff.appeared.push_back(insert(fresh));
+            }
+        }
+    }
+
+    void sweep() {
+        stale.clear();
+        for (const auto& entry : slots) {
+            if (entry.tid == 0 || entry.generation == generation) continue;
+            if (entry.ruleMask) diff.exited.push_back(entry);
+            stale.push_back(entry.tid);
+        }
+        for (pid_t tid : stale) erase(tid);
+    }
+};
+
+// Process connector listener. Reports the thread groups that exec'd or
+// changed comm, which is when a process takes on the name rules match.
+class ProcEvents {
+private:
+    int sock = -1;
+
+    bool subscribe() {
+        sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+        if (sock < 0) return false;
+
+        sockaddr_nl addr{};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = CN_IDX_PROC;
+        if (bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) return false;
+
+        alignas(nlmsghdr) char buf[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))] = {};
+        auto* nl = reinterpret_cast<nlmsghdr*>(buf);
+        nl->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+        nl->nlmsg_type = NLMSG_DONE;
+        nl->nlmsg_pid = static_cast<__u32>(getpid());
+
+        auto* cn = static_cast<cn_msg*>(NLMSG_DATA(nl));
+        cn->id.idx = CN_IDX_PROC;
+        cn->id.val = CN_VAL_PROC;
+        cn->len = sizeof(proc_cn_mcast_op);
+        const proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+        std::memcpy(cn->data, &op, sizeof(op));
+
+        return send(sock, buf, nl->nlmsg_len, 0) == static_cast<ssize_t>(nl->nlmsg_len);
+    }
+
+    // Appends exec/comm tgids from pending messages; true on overflow
+    bool drain(std::vector<pid_t>& out) {
+        alignas(nlmsghdr) char buf[8192];
+        for (;;) {
+            int len = static_cast<int>(recv(sock, buf, sizeof(buf), MSG_DONTWAIT));
+            if (len < 0) return errno == ENOBUFS;
+
+            for (auto* nl = reinterpret_cast<nlmsghdr*>(buf); NLMSG_OK(nl, len);
+                 nl = NLMSG_NEXT(nl, len)) {
+                const auto* cn = static_cast<const cn_msg*>(NLMSG_DATA(nl));
+                const auto* ev = reinterpret_cast<const proc_event*>(cn->data);
+                if (ev->what == proc_event::PROC_EVENT_EXEC) {
+                    out.push_back(ev->event_data.exec.process_tgid);
+                } else if (ev->what == proc_event::PROC_EVENT_COMM) {
+                    out.push_back(ev->event_data.comm.process_tgid);
+                }
+            }
+        }
+    }
+
+public:
+    ProcEvents() {
+        if (!subscribe()) {
+            if (sock >= 0) close(sock);
+            sock = -1;
+            Logger::log("Proc connector unavailable, polling /proc instead");
+        }
+    }
+
+    ~ProcEvents() {
+        if (sock >= 0) close(sock);
+    }
+
+    ProcEvents(const ProcEvents&) = delete;
+    ProcEvents& operator=(const ProcEvents&) = delete;
+
+    bool available() const { return sock >= 0; }
+
+    // Waits up to timeoutMs for events and collects the affected tgids,
+    // deduplicated. Events of a burst are gathered for a short debounce.
+    // Returns true when the socket overflowed and a full rescan is needed.
+    bool wait(int timeoutMs, std::vector<pid_t>& tgids) {
+        tgids.clear();
+        if (sock < 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+            return true;
+        }
+
+        pollfd pfd{sock, POLLIN, 0};
+        if (poll(&pfd, 1, timeoutMs) <= 0) return false;
+
+        bool overflow = drain(tgids);
+        while (poll(&pfd, 1, config::EVENT_DEBOUNCE_MS) > 0) overflow |= drain(tgids);
+
+        std::sort(tgids.begin(), tgids.end());
+        tgids.erase(std::unique(tgids.begin(), tgids.end()), tgids.end());
+        return overflow;
+    }
+};
+
+// Watches CPU thermal zones and cpufreq cooling devices. Trip-point
+// uevents wake the daemon early; otherwise it is sampled on a timer.
+class ThermalMonitor {
+private:
+    std::vector<std::string> zones;   // temp files
+    std::vector<std::string> coolers; // cur_state files
+    int ueventSock = -1;
+    bool hot = false;
+    int lastTemp = 0; // millidegrees C
+
+    static bool typeContains(const std::string& dir, const char* needle) {
+        char type[64];
+        std::string path = dir + "/type";
+        if (ProcessUtils::readFile(path.c_str(), type, sizeof(type)) <= 0) return false;
+        for (char* c = type; *c; ++c) *c = static_cast<char>(std::tolower(*c));
+        return std::strstr(type, needle) != nullptr;
+    }
+
+    static int readInt(const std::string& path) {
+        char buf[32];
+        if (ProcessUtils::readFile(path.c_str(), buf, sizeof(buf)) <= 0) return 0;
+        return std::atoi(buf);
+    }
+
+    void discover() {
+        std::vector<std::string> allZones;
+        for (int i = 0; i < 128; ++i) {
+            std::string zone = "/sys/class/thermal/thermal_zone" + std::to_string(i);
+            if (access(zone.c_str(), F_OK) != 0) break;
+            allZones.push_back(zone + "/temp");
+            if (typeContains(zone, "cpu")) zones.push_back(zone + "/temp");
+        }
+        // No zone names a CPU (e.g. generic "soc_thermal"): watch them all
+        if (zones.empty()) zones = std::move(allZones);
+
+        for (int i = 0; i < 128; ++i) {
+            std::string dev = "/sys/class/thermal/cooling_device" + std::to_string(i);
+            if (access(dev.c_str(), F_OK) != 0) break;
+            if (typeContains(dev, "cpu")) coolers.push_back(dev + "/cur_state");
+        }
+    }
+
+    void subscribe() {
+        ueventSock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+        if (ueventSock < 0) return;
+        sockaddr_nl addr{};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = 1; // kernel uevents
+        if (bind(ueventSock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            close(ueventSock);
+            ueventSock = -1;
+        }
+    }
+
+    // True if any pending uevent came from the thermal subsystem
+    bool drainUevents() {
+        bool thermal = false;
+        char buf[4096];
+        for (;;) {
+            ssize_t len = recv(ueventSock, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+            if (len <= 0) break;
+            buf[len] = '\0';
+            // Payload is NUL-separated KEY=VALUE pairs after the header
+            for (const char* p = buf; p < buf + len; p += std::strlen(p) + 1) {
+                if (std::strcmp(p, "SUBSYSTEM=thermal") == 0) thermal = true;
+            }
+        }
+        return thermal;
+    }
+
+public:
+    ThermalMonitor() {
+        discover();
+        subscribe();
+        Logger::logf(false, "Thermal monitor: %zu zones, %zu cpu cooling devices, uevents %s",
+                     zones.size(), coolers.size(), ueventSock >= 0 ? "on" : "off");
+    }
+
+    ~ThermalMonitor() {
+        if (ueventSock >= 0) close(ueventSock);
+    }
+
+    ThermalMonitor(const ThermalMonitor&) = delete;
+    ThermalMonitor& operator=(const ThermalMonitor&) = delete;
+
+    bool available() const { return !zones.empty(); }
+    bool isHot() const { return hot; }
+    int temperature() const { return lastTemp; }
+
+    // Uevent socket for the caller's poll set, or -1
+    int fd() const { return ueventSock; }
+
+    // Called when fd() is readable; true if a thermal uevent arrived
+    bool tripped() { return ueventSock >= 0 && drainUevents(); }
+
+    // Samples sensors; returns true when the hot/cool state flipped.
+    // Hot at HOT threshold or while a CPU cooling device throttles; cool
+    // again only below the lower COOL threshold, so it never flaps.
+    bool update() {
+        int maxTemp = 0;
+        for (const auto& zone : zones) maxTemp = std::max(maxTemp, readInt(zone));
+        bool throttled = std::any_of(coolers.begin(), coolers.end(),
+                                     [](const std::string& dev) { return readInt(dev) > 0; });
+        lastTemp = maxTemp;
+
+        bool next = hot ? (maxTemp > config::THERMAL_COOL_MC || throttled)
+                        : (maxTemp >= config::THERMAL_HOT_MC || throttled);
+        if (next == hot) return false;
+        hot = next;
+        return true;
+    }
+};
+
+// Unix domain socket for talking to the running daemon. Line protocol:
+// the client sends one command line, the daemon answers with text lines
+// and closes. Connections are non-blocking members of the daemon's own
+// poll set and are read only as data arrives, at most MAX_CLIENTS at a
+// time, so a slow or flooding client never stalls tuning.
+class ControlServer {
+public:
+    // Connections read at once; further ones wait in the listen backlog
+    static constexpr size_t MAX_CLIENTS = 4;
+    // Entries pollSet fills: the listening socket, then one per client
+    static constexpr size_t POLL_FDS = 1 + MAX_CLIENTS;
+
+    // Reply text, formatted into a fixed buffer
+    struct Reply {
+        char data[8192];
+        size_t len = 0;
+
+        __attribute__((format(printf, 2, 3)))
+        void line(const char* fmt, ...) {
+            if (len + 1 >= sizeof(data)) return;
+            va_list args;
+            va_start(args, fmt);
+            int n = std::vsnprintf(data + len, sizeof(data) - len - 1, fmt, args);
+            va_end(args);
+            if (n < 0) return;
+            len = std::min(len + static_cast<size_t>(n), sizeof(data) - 2);
+            data[len++] = '\n';
+        }
+    };
+
+private:
+    using clock = std::chrono::steady_clock;
+    static constexpr int REQUEST_TIMEOUT_MS = 100;
+    static constexpr size_t MAX_REQUEST = 128;
+
+    // A connection whose request line is still arriving
+    struct Client {
+        int fd = -1;
+        size_t len = 0;
+        char request[MAX_REQUEST];
+        clock::time_point deadline;
+    };
+
+    int listenFd = -1;
+    std::array<Client, MAX_CLIENTS> clients;
+
+    static bool socketAddress(sockaddr_un& addr) {
+        addr = sockaddr_un{};
+        addr.sun_family = AF_UNIX;
+        if (std::strlen(config::CONTROL_SOCKET) >= sizeof(addr.sun_path)) return false;
+        std::strcpy(addr.sun_path, config::CONTROL_SOCKET);
+        return true;
+    }
+
+    static void drop(Client& client) {
+        close(client.fd);
+        client.fd = -1;
+    }
+
+    // Takes what the client has sent so far without waiting for more; a
+    // complete line (or a full buffer) is answered and the client closed
+    template <typename Handler>
+    static void readClient(Client& client, Handler& handle) {
+        ssize_t n = recv(client.fd, client.request + client.len, MAX_REQUEST - 1 - client.len,
+                         MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            drop(client);
+            return;
+        }
+        client.len += static_cast<size_t>(n);
+        client.request[client.len] = '\0';
+        if (!std::memchr(client.request, '\n', client.len) && client.len + 1 < MAX_REQUEST) return;
+
+        client.request[std::strcspn(client.request, "\r\n")] = '\0';
+        Reply reply;
+        handle(std::string_view(client.request), reply);
+        ssize_t ignored = send(client.fd, reply.data, reply.len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        (void)ignored;
+        drop(client);
+    }
+
+public:
+    ControlServer() {
+        sockaddr_un addr;
+        if (!socketAddress(addr)) return;
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0) return;
+
+        unlink(config::CONTROL_SOCKET);
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            chmod(config::CONTROL_SOCKET, 0600) != 0 || listen(listenFd, 4) != 0) {
+            Logger::logf(true, "Control socket unavailable: %s", strerror(errno));
+            close(listenFd);
+            listenFd = -1;
+        }
+    }
+
+    ~ControlServer() {
+        for (auto& client : clients) {
+            if (client.fd >= 0) drop(client);
+        }
+        if (listenFd < 0) return;
+        close(listenFd);
+        unlink(config::CONTROL_SOCKET);
+    }
+
+    ControlServer(const ControlServer&) = delete;
+    ControlServer& operator=(const ControlServer&) = delete;
+
+    // Fills POLL_FDS entries of the caller's poll set: the listening
+    // socket while a client slot is free, then each pending client.
+    // Unused entries get fd -1, which poll skips.
+    void pollSet(pollfd* fds) const {
+        bool slotFree = false;
+        for (size_t i = 0; i < MAX_CLIENTS; ++i) {
+            fds[1 + i] = pollfd{clients[i].fd, POLLIN, 0};
+            slotFree |= clients[i].fd < 0;
+        }
+        fds[0] = pollfd{slotFree ? listenFd : -1, POLLIN, 0};
+    }
+
+    // When the oldest pending client times out, or max() with none
+    clock::time_point nextDeadline() const {
+        auto deadline = clock::time_point::max();
+        for (const auto& client : clients) {
+            if (client.fd >= 0) deadline = std::min(deadline, client.deadline);
+        }
+        return deadline;
+    }
+
+    // Call after every poll with the entries pollSet filled. Reads ready
+    // clients, answers complete requests through handle(command, reply),
+    // drops clients past their deadline and accepts new connections into
+    // free slots; one call never does more than MAX_CLIENTS of each.
+    template <typename Handler>
+    void serve(const pollfd* fds, Handler&& handle) {
+        const auto now = clock::now();
+        for (size_t i = 0; i < MAX_CLIENTS; ++i) {
+            Client& client = clients[i];
+            if (client.fd < 0) continue;
+            if (fds[1 + i].fd == client.fd && fds[1 + i].revents) readClient(client, handle);
+            if (client.fd >= 0 && now >= client.deadline) drop(client);
+        }
+
+        if (fds[0].fd < 0 || !(fds[0].revents & POLLIN)) return;
+        for (auto& client : clients) {
+            if (client.fd >= 0) continue;
+            client.fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client.fd < 0) return;
+            client.len = 0;
+            client.deadline = now + std::chrono::milliseconds(REQUEST_TIMEOUT_MS);
+            readClient(client, handle); // the request usually comes with the connection
+        }
+    }
+
+    // Client side: sends command and copies the reply into out.
+    // Returns 0 or errno (ECONNREFUSED / ENOENT when no daemon listens).
+    static int query(const char* command, char* out, size_t size) {
+        sockaddr_un addr;
+        if (!socketAddress(addr)) return ENAMETOOLONG;
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return errno;
+
+        int err = 0;
+        size_t len = 0;
+        char request[MAX_REQUEST];
+        const int requestLen = std::snprintf(request, sizeof(request), "%s\n", command);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            send(fd, request, std::min<size_t>(requestLen, sizeof(request) - 1), MSG_NOSIGNAL) < 0) {
+            err = errno;
+        } else {
+            ssize_t n;
+            while (len + 1 < size && (n = recv(fd, out + len, size - 1 - len, 0)) > 0) {
+                len += static_cast<size_t>(n);
+            }
+        }
+        close(fd);
+        out[len] = '\0';
+        return err;
+    }
+};
+
+// Pre-tuning scheduling state of every thread the optimizer touched,
+// keyed by tid + start time, with the process-wide memory and I/O weight
+// controls on the leader's record, plus the original affinity of every IRQ it
+// steered and the nice and cpumask of every workqueue it tuned. Persisted as a flat binary file so a later restore can revert
+// tuning. The header carries the boot id, so a snapshot from a previous
+// boot is discarded.
+class StateSnapshot {
+private:
+    static constexpr uint32_t MAGIC = 0x53534f54; // "TOSS"
+    static constexpr uint32_t VERSION = 6;
+    static constexpr size_t BOOT_ID_LEN = 40; // 36-char uuid, padded
+
+    // Followed by count Records, irqCount IrqRecords, then
+    // workqueueCount WorkqueueRecords
+    struct Header {
+        uint32_t magic = MAGIC;
+        uint32_t version = VERSION;
+        uint32_t count = 0;
+        uint32_t irqCount = 0;
+        uint32_t workqueueCount = 0;
+        uint32_t reserved = 0;
+        char bootId[BOOT_ID_LEN] = {};
+    };
+
+    // Process-wide fields a leader's record holds, set in Record::saved
+    static constexpr uint32_t SAVED_OOM = 1;
+    static constexpr uint32_t SAVED_MEMORY_HIGH = 2;
+    static constexpr uint32_t SAVED_IO_WEIGHT = 4;
+    static constexpr uint32_t SAVED_BFQ_WEIGHT = 8; // ioWeight is from io.bfq.weight
+
+    // Affinity keeps the first 64 CPUs, enough for any phone SoC. The
+    // cpuset path is empty when it could not be read. The fields after it
+    // are only captured for leaders of processes whose rules change them.
+    struct Record {
+        int32_t tid;
+        int32_t nice;
+        uint64_t startTime;
+        int32_t policy;
+        int32_t rtPriority;
+        int32_t ioprio;
+        uint32_t saved; // SAVED_* bits
+        uint64_t affinity;
+        char cpuset[64];
+        int32_t oomScoreAdj;
+        char memoryHigh[24]; // bytes or "max"
+        char ioWeight[24]; // "default 100", or "100" on older BFQ
+    };
+
+    // smp_affinity_list text as read before the first steer
+    struct IrqRecord {
+        int32_t irq;
+        char affinity[60];
+    };
+
+    // Attributes as read before the first write; names fit WQ_NAME_LEN
+    struct WorkqueueRecord {
+        char name[32];
+        int32_t nice;
+        char cpumask[92];
+    };
+
+    std::vector<Record> records;
+    std::vector<IrqRecord> irqs;
+    std::vector<WorkqueueRecord> workqueues;
+    std::unordered_map<TaskId, size_t, TaskIdHash> index; // records slot
+    char bootId[BOOT_ID_LEN] = {};
+    bool dirty = false;
+
+    static TaskId idOf(const Record& record) { return TaskId{record.tid, record.startTime}; }
+
+    static uint64_t packMask(const cpu_set_t& mask) {
+        uint64_t bits = 0;
+        for (int cpu = 0; cpu < 64; ++cpu) {
+            if (CPU_ISSET(cpu, &mask)) bits |= uint64_t{1} << cpu;
+        }
+        return bits;
+    }
+
+    static void unpackMask(uint64_t bits, cpu_set_t& mask) {
+        CPU_ZERO(&mask);
+        for (int cpu = 0; cpu < 64; ++cpu) {
+            if (bits & (uint64_t{1} << cpu)) CPU_SET(cpu, &mask);
+        }
+    }
+
+    static void stateOf(const Record& record, SyscallOptimizer::SchedState& state) {
+        state.nice = record.nice;
+        state.policy = record.policy;
+        state.rtPriority = record.rtPriority;
+        state.ioprio = record.ioprio;
+        unpackMask(record.affinity, state.affinity);
+    }
+
+public:
+    StateSnapshot() {
+        char id[BOOT_ID_LEN] = {};
+        if (ProcessUtils::readFile("/proc/sys/kernel/random/boot_id", id, sizeof(id)) > 0) {
+            std::memcpy(bootId, id, std::strcspn(id, "\n"));
+        }
+    }
+
+    size_t size() const { return records.size(); }
+
+    // Pre-tuning state of id; false if it was never captured
+    bool lookup(const TaskId& id, SyscallOptimizer::SchedState& state) const {
+        auto it = index.find(id);
+        if (it == index.end()) return false;
+        stateOf(records[it->second], state);
+        return true;
+    }
+
+    // Loads a snapshot written earlier this boot; returns false if none
+    bool load() {
+        int fd = open(config::SNAPSHOT_FILE, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+
+        Header header;
+        bool ok = read(fd, &header, sizeof(header)) == static_cast<ssize_t>(sizeof(header)) &&
+                  header.magic == MAGIC && header.version == VERSION &&
+                  std::memcmp(header.bootId, bootId, BOOT_ID_LEN) == 0;
+        if (ok) {
+            records.resize(header.count);
+            irqs.resize(header.irqCount);
+            workqueues.resize(header.workqueueCount);
+            const ssize_t bytes = static_cast<ssize_t>(header.count * sizeof(Record));
+            const ssize_t irqBytes = static_cast<ssize_t>(header.irqCount * sizeof(IrqRecord));
+            const ssize_t wqBytes =
+                static_cast<ssize_t>(header.workqueueCount * sizeof(WorkqueueRecord));
+            ok = read(fd, records.data(), bytes) == bytes &&
+                 read(fd, irqs.data(), irqBytes) == irqBytes &&
+                 read(fd, workqueues.data(), wqBytes) == wqBytes;
+        }
+        close(fd);
+
+        if (!ok) {
+            records.clear();
+            irqs.clear();
+            workqueues.clear();
+        }
+        index.clear();
+        for (size_t i = 0; i < records.size(); ++i) index[idOf(records[i])] = i;
+        return ok;
+    }
+
+    // Reads the process-wide controls of a leader not yet on its record
+    void captureProcess(Record& record) {
+        if (!(record.saved & SAVED_OOM) && MemoryPolicy::getOomScoreAdj(record.tid, record.oomScoreAdj)) {
+            record.saved |= SAVED_OOM;
+            dirty = true;
+        }
+        if (!(record.saved & SAVED_MEMORY_HIGH) &&
+            OwnCgroup::read(record.tid, "memory.high", record.memoryHigh, sizeof(record.memoryHigh))) {
+            record.saved |= SAVED_MEMORY_HIGH;
+            dirty = true;
+        }
+        bool bfq = false;
+        if (!(record.saved & SAVED_IO_WEIGHT) &&
+            OwnCgroup::getIOWeight(record.tid, record.ioWeight, sizeof(record.ioWeight), bfq)) {
+            record.saved |= SAVED_IO_WEIGHT | (bfq ? SAVED_BFQ_WEIGHT : 0);
+            dirty = true;
+        }
+    }
+
+    // Records the current state of tasks not yet captured, and the
+    // process-wide controls of leaders matched by processRules
+    void capture(const std::vector<ProcessTable::Entry>& entries, uint64_t processRules) {
+        for (const auto& entry : entries) {
+            const bool processWide = entry.tid == entry.tgid && (entry.ruleMask & processRules);
+            auto it = index.find(entry.id());
+            if (it != index.end()) {
+                // A renamed process may have picked up a rule that changes them
+                if (processWide) captureProcess(records[it->second]);
+                continue;
+            }
+
+            SyscallOptimizer::SchedState state;
+            if (SyscallOptimizer::getState(entry.tid, state) != 0) continue;
+
+            Record record{entry.tid, state.nice, entry.startTime, state.policy,
+                          state.rtPriority, state.ioprio, 0, packMask(state.affinity), {}, 0, {}, {}};
+            if (!CpusetGroups::pathOf(entry.tid, record.cpuset, sizeof(record.cpuset))) {
+                record.cpuset[0] = '\0';
+            }
+            if (processWide) captureProcess(record);
+            index.emplace(entry.id(), records.size());
+            records.push_back(record);
+            dirty = true;
+        }
+    }
+
+    // Records irq's affinity unless already on record; true if it was new
+    bool captureIrq(int irq) {
+        for (const auto& record : irqs) {
+            if (record.irq == irq) return false;
+        }
+        IrqRecord record{irq, {}};
+        if (!Interrupts::getAffinity(irq, record.affinity, sizeof(record.affinity))) return false;
+        irqs.push_back(record);
+        dirty = true;
+        return true;
+    }
+
+    // For an IRQ whose first steer failed: it was never changed
+    void forgetIrq(int irq) {
+        auto it = std::find_if(irqs.begin(), irqs.end(),
+                               [&](const IrqRecord& record) { return record.irq == irq; });
+        if (it == irqs.end()) return;
+        irqs.erase(it);
+        dirty = true;
+    }
+
+    size_t irqCount() const { return irqs.size(); }
+
+    // Writes back every recorded IRQ affinity; returns the failures
+    int restoreIrqs(int& restored) {
+        restored = 0;
+        int failed = 0;
+        for (const auto& record : irqs) {
+            if (int err = Interrupts::setAffinity(record.irq, record.affinity)) {
+                ++failed;
+                Logger::logf(true, "Failed restore for IRQ %d to %s: %s", record.irq,
+                             record.affinity, strerror(err));
+            } else {
+                ++restored;
+            }
+        }
+        return failed;
+    }
+
+    // Records a workqueue's nice and cpumask unless already on record;
+    // false if they could not be read, in which case it must not be tuned
+    bool captureWorkqueue(const char* name) {
+        for (const auto& record : workqueues) {
+            if (std::strcmp(record.name, name) == 0) return true;
+        }
+        WorkqueueRecord record{};
+        char nice[16];
+        if (std::snprintf(record.name, sizeof(record.name), "%s", name) >=
+                static_cast<int>(sizeof(record.name)) ||
+            !Workqueues::readAttr(name, "nice", nice, sizeof(nice)) ||
+            !Workqueues::readAttr(name, "cpumask", record.cpumask, sizeof(record.cpumask))) {
+            return false;
+        }
+        record.nice = static_cast<int32_t>(std::strtol(nice, nullptr, 10));
+        workqueues.push_back(record);
+        dirty = true;
+        return true;
+    }
+
+    size_t workqueueCount() const { return workqueues.size(); }
+
+    // Writes back every recorded workqueue's cpumask and nice; returns
+    // the failures
+    int restoreWorkqueues(int& restored) {
+        restored = 0;
+        int failed = 0;
+        for (const auto& record : workqueues) {
+            int err = Workqueues::setCpumask(record.name, record.cpumask);
+            if (!err) err = Workqueues::setNice(record.name, record.nice);
+            if (err) {
+                ++failed;
+                Logger::logf(true, "Failed restore for workqueue %s: %s", record.name, strerror(err));
+            } else {
+                ++restored;
+            }
+        }
+        return failed;
+    }
+
+    // Drops records of threads that exited, so the file tracks live tasks.
+    // Threads that were only renamed away keep their record for restore.
+    void forget(const std::vector<ProcessTable::Entry>& entries) {
+        for (const auto& entry : entries) {
+            auto it = index.find(entry.id());
+            if (it == index.end() || entry.id().alive()) continue;
+
+            const size_t slot = it->second;
+            index.erase(it);
+            if (slot != records.size() - 1) {
+                records[slot] = records.back();
+                index[idOf(records[slot])] = slot;
+            }
+            records.pop_back();
+            dirty = true;
+        }
+    }
+
+    // Writes the snapshot atomically if it changed; returns 0 or errno
+    int save() {
+        if (!dirty) return 0;
+
+        char tmpPath[128];
+        std::snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", config::SNAPSHOT_FILE);
+        int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) return errno;
+
+        Header header;
+        header.count = static_cast<uint32_t>(records.size());
+        header.irqCount = static_cast<uint32_t>(irqs.size());
+        header.workqueueCount = static_cast<uint32_t>(workqueues.size());
+        std::memcpy(header.bootId, bootId, BOOT_ID_LEN);
+        const ssize_t bytes = static_cast<ssize_t>(records.size() * sizeof(Record));
+        const ssize_t irqBytes = static_cast<ssize_t>(irqs.size() * sizeof(IrqRecord));
+        const ssize_t wqBytes = static_cast<ssize_t>(workqueues.size() * sizeof(WorkqueueRecord));
+        errno = 0;
+        int err = write(fd, &header, sizeof(header)) == static_cast<ssize_t>(sizeof(header)) &&
+                  write(fd, records.data(), bytes) == bytes &&
+                  write(fd, irqs.data(), irqBytes) == irqBytes &&
+                  write(fd, workqueues.data(), wqBytes) == wqBytes ? 0 : (errno ? errno : EIO);
+        if (close(fd) != 0 && err == 0) err = errno;
+        if (err == 0 && rename(tmpPath, config::SNAPSHOT_FILE) != 0) err = errno;
+        if (err) {
+            unlink(tmpPath);
+            return err;
+        }
+        dirty = false;
+        return 0;
+    }
+
+    // Reverts every recorded thread that is still the same task, then
+    // drops the optimizer's emptied cpusets. The cpuset goes first, as
+    // moving a thread resets its affinity to the cpuset's cores.
+    // Returns the number of threads that failed to restore.
+    int restore(int& restored) {
+        restored = 0;
+        int failed = 0;
+        for (const auto& record : records) {
+            if (!idOf(record).alive()) continue;
+
+            char current[sizeof(record.cpuset)];
+            if (record.cpuset[0] && CpusetGroups::pathOf(record.tid, current, sizeof(current)) &&
+                std::strcmp(current, record.cpuset) != 0) {
+                if (int err = CpusetGroups::moveThread(record.tid, record.cpuset)) {
+                    Logger::logf(true, "Failed cpuset restore for TID %d to %s: %s", record.tid,
+                                 record.cpuset, strerror(err));
+                }
+            }
+
+            SyscallOptimizer::SchedState state;
+            stateOf(record, state);
+
+            int err = SyscallOptimizer::setState(record.tid, state);
+            if (!err && (record.saved & SAVED_OOM)) {
+                err = MemoryPolicy::setOomScoreAdj(record.tid, record.oomScoreAdj);
+            }
+            if (!err && (record.saved & SAVED_MEMORY_HIGH)) {
+                err = MemoryPolicy::setMemoryHigh(record.tid, record.memoryHigh);
+            }
+            if (!err && (record.saved & SAVED_IO_WEIGHT)) {
+                err = OwnCgroup::setIOWeight(record.tid, record.ioWeight, record.saved & SAVED_BFQ_WEIGHT);
+            }
+            if (err == 0) {
+                ++restored;
+                continue;
+            }
+            ++failed;
+            Logger::logf(true, "Failed restore for TID %d: %s", record.tid, strerror(err));
+        }
+        CpusetGroups::removeAll();
+        return failed;
+    }
+};
+
+// Individual setters a rule can apply; each one runs and is counted on its own.
+// Actions from OomAdj on act on a whole process through its leader.
+enum class Action : uint8_t { Nice, RT, Affinity, IOPrio, OomAdj, MemHigh, IOWeight, Reclaim, Count };
+
+constexpr std::array<const char*, static_cast<size_t>(Action::Count)> ACTION_NAMES = {
+    "nice", "rt", "affinity", "ioprio", "oom", "memhigh", "ioweight", "reclaim"
+};
+
+constexpr bool isProcessAction(Action action) { return action >= Action::OomAdj; }
+
+// Flat action table for a rule; unset fields are skipped
+struct Policy {
+    static constexpr int UNSET = INT_MIN;
+
+    int nice = UNSET;
+    int rtPriority = UNSET; // SCHED_FIFO priority
+    int ioClass = UNSET;
+    int ioLevel = 0; // 0 (highest) to 7, for the RT and BE classes
+    CPUTopology::CoreSet affinity = CPUTopology::CoreSet::None;
+    int minCapacity = 0; // for CoreSet::Energy, on the 0-1024 cpu_capacity scale
+    char affinityExpr[48] = {}; // for CoreSet::Expr, see CPUTopology::parseMask
+    bool binderBoost = false; // binder pool threads get the policy only while busy
+    bool migrate = false; // busy threads may widen to all cores, see TIER_*
+    bool irq = false; // hard IRQs with matching action names get the affinity too
+    int oomScoreAdj = UNSET;
+    long long memoryHigh = 0; // cgroup v2 memory.high in bytes, 0 for none
+    int ioWeight = 0; // cgroup v2 io.bfq.weight / io.weight (1-1000), 0 for none
+    int reclaim = 0; // MADV_COLD or MADV_PAGEOUT under memory pressure, see RECLAIM_*
+};
+
+// Stats tracking
+class StatsTracker {
+private:
+    static constexpr size_t ACTIONS = static_cast<size_t>(Action::Count);
+
+    std::atomic<int> successCount{0};
+    std::atomic<int> failureCount{0};
+    std::atomic<int> totalOps{0};
+    std::array<std::atomic<int>, ACTIONS> actionSuccess{};
+    std::array<std::atomic<int>, ACTIONS> actionFailure{};
+    std::atomic<int> coalescedCalls{0};
+    std::atomic<int> coalescedThreads{0};
+    std::atomic<int> throttledBlocks{0};
+    std::atomic<int> throttledThreads{0};
+
+    // Pass latency histogram, power-of-two microsecond buckets
+    static constexpr size_t LATENCY_BUCKETS = 24;
+    std::array<std::atomic<int>, LATENCY_BUCKETS> passLatency{};
+
+public:
+    void recordSuccess(Action action, int threads = 1) {
+        successCount += threads;
+        totalOps += threads;
+        actionSuccess[static_cast<size_t>(action)] += threads;
+    }
+
+    // One process-wide call that stood in for per-thread syscalls
+    void recordCoalesced(int threads) {
+        ++coalescedCalls;
+        coalescedThreads += threads;
+    }
+
+    void recordFailure(Action action) {
+        ++failureCount;
+        ++totalOps;
+        ++actionFailure[static_cast<size_t>(action)];
+    }
+
+    // A thread group deferred because a setter budget ran out
+    void recordThrottled(int threads) {
+        ++throttledBlocks;
+        throttledThreads += threads;
+    }
+
+    // Duration of one scan-and-apply pass
+    void recordPass(long long micros) {
+        size_t bucket = 0;
+        while (bucket + 1 < LATENCY_BUCKETS && (1LL << (bucket + 1)) <= micros) ++bucket;
+        ++passLatency[bucket];
+    }
+
+    // Calls out(line) for each line of the stats report
+    template <typename Out>
+    void emit(Out&& out) const {
+        char line[256];
+        std::snprintf(line, sizeof(line), "Operations: %d | Success: %d | Failed: %d",
+                      totalOps.load(), successCount.load(), failureCount.load());
+        out(line);
+
+        size_t len = std::snprintf(line, sizeof(line), "Per action (ok/failed): ");
+        for (size_t i = 0; i < ACTIONS && len < sizeof(line); ++i) {
+            int n = std::snprintf(line + len, sizeof(line) - len, "%s%s %d/%d",
+                                  i ? " | " : "", ACTION_NAMES[i],
+                                  actionSuccess[i].load(), actionFailure[i].load());
+            if (n < 0) break;
+            len += static_cast<size_t>(n);
+        }
+        out(line);
+
+        std::snprintf(line, sizeof(line), "Coalesced: %d process-wide calls covering %d threads",
+                      coalescedCalls.load(), coalescedThreads.load());
+        out(line);
+
+        std::snprintf(line, sizeof(line), "Throttled: %d deferrals covering %d threads",
+                      throttledBlocks.load(), throttledThreads.load());
+        out(line);
+    }
+
+    // Calls out(line) per non-empty bucket, "<lower bound us> <count>"
+    template <typename Out>
+    void emitHistogram(Out&& out) const {
+        char line[64];
+        for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+            const int n = passLatency[i].load();
+            if (n == 0) continue;
+            std::snprintf(line, sizeof(line), "pass_us >=%lld: %d", i ? 1LL << i : 0LL, n);
+            out(line);
+        }
+    }
+
+    void report() const {
+        emit([](const char* line) { Logger::log(line); });
+    }
+};
+
+// Token bucket: refills at rate tokens/s up to burst
+class TokenBucket {
+private:
+    using clock = std::chrono::steady_clock;
+    double tokens;
+    double rate;
+    double burst;
+    clock::time_point last = clock::now();
+
+public:
+    TokenBucket(int ratePerSec, int burstSize)
+        : tokens(burstSize), rate(ratePerSec), burst(burstSize) {}
+
+    bool take(clock::time_point now) {
+        tokens = std::min(burst, tokens + std::chrono::duration<double>(now - last).count() * rate);
+        last = now;
+        if (tokens < 1) return false;
+        tokens -= 1;
+        return true;
+    }
+};
+
+// CPU time of managed threads, charged to every rule a thread matches and
+// to the tier of the CPU it last ran on. Each thread's stat file stays
+// open and is re-read with pread, so a sample does no path lookups and
+// no allocation; an fd also stays bound to its task if the tid is reused.
+class UtilSampler {
+public:
+    static constexpr size_t MAX_RULES = 64;
+    static constexpr size_t TIERS = static_cast<size_t>(CPUTopology::Tier::Count);
+
+private:
+    static constexpr unsigned long long UNSAMPLED = ~0ULL;
+
+    struct Thread {
+        TaskId id;
+        int fd = -1;
+        uint64_t ruleMask = 0;
+        unsigned long long cpuTime = UNSAMPLED;
+        unsigned long long lastDelta = 0; // ticks in the last interval
+        bool bound = false;
+    };
+
+    using Ticks = std::array<std::array<unsigned long long, TIERS>, MAX_RULES>;
+
+    std::vector<Thread> threads;
+    std::unordered_map<TaskId, size_t, TaskIdHash> index; // threads slot
+    Ticks window{}; // last sample interval
+    Ticks total{};
+    std::chrono::steady_clock::time_point lastSample = std::chrono::steady_clock::now();
+    double windowSeconds = 0;
+    size_t skipped = 0; // threads not sampled because of the fd cap
+    const long ticksPerSecond = sysconf(_SC_CLK_TCK);
+
+    void add(const ProcessTable::Entry& entry) {
+        if (threads.size() >= config::UTIL_MAX_FDS) {
+            ++skipped;
+            return;
+        }
+        char path[ProcReader::PATH_SIZE];
+        std::snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", entry.tgid, entry.tid);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+
+        Thread thread;
+        thread.id = entry.id();
+        thread.fd = fd;
+        thread.ruleMask = entry.ruleMask;
+        thread.bound = entry.bound;
+        index.emplace(thread.id, threads.size());
+        threads.push_back(thread);
+    }
+
+    void remove(const TaskId& id) {
+        auto it = index.find(id);
+        if (it == index.end()) return;
+        const size_t slot = it->second;
+        close(threads[slot].fd);
+        index.erase(it);
+        if (slot != threads.size() - 1) {
+            threads[slot] = threads.back();
+            index[threads[slot].id] = slot;
+        }
+        threads.pop_back();
+    }
+
+public:
+    UtilSampler() {
+        // Room for the kept-open stat files on top of the daemon's own fds;
+        // the soft limit is only ever raised
+        rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+            const rlim_t wanted = std::min<rlim_t>(limit.rlim_max, config::UTIL_MAX_FDS + 256);
+            if (wanted > limit.rlim_cur) {
+                limit.rlim_cur = wanted;
+                setrlimit(RLIMIT_NOFILE, &limit);
+            }
+        }
+    }
+
+    ~UtilSampler() { clear(); }
+
+    UtilSampler(const UtilSampler&) = delete;
+    UtilSampler& operator=(const UtilSampler&) = delete;
+
+    size_t size() const { return threads.size(); }
+
+    void clear() {
+        for (auto& thread : threads) close(thread.fd);
+        threads.clear();
+        index.clear();
+        window = {};
+        total = {};
+        skipped = 0;
+    }
+
+    void track(const ProcessTable::Diff& diff) {
+        for (const auto& entry : diff.exited) remove(entry.id());
+        for (const auto& entry : diff.appeared) {
+            if (!index.count(entry.id())) add(entry);
+        }
+        for (const auto& entry : diff.renamed) {
+            auto it = index.find(entry.id());
+            if (it == index.end()) add(entry);
+            else threads[it->second].ruleMask = entry.ruleMask;
+        }
+    }
+
+    void sample() {
+        const auto now = std::chrono::steady_clock::now();
+        windowSeconds = std::chrono::duration<double>(now - lastSample).count();
+        lastSample = now;
+        window = {};
+
+        char buf[ProcReader::BUF_SIZE];
+        for (auto& thread : threads) {
+            ssize_t n = pread(thread.fd, buf, sizeof(buf) - 1, 0);
+            if (n <= 0) continue; // exited; dropped on the next rescan
+            buf[n] = '\0';
+
+            unsigned long long cpuTime = 0;
+            int processor = -1;
+            if (!ProcessUtils::parseCpuUsage(buf, cpuTime, processor)) continue;
+            const unsigned long long delta = thread.cpuTime == UNSAMPLED ? 0 : cpuTime - thread.cpuTime;
+            thread.cpuTime = cpuTime;
+            thread.lastDelta = delta;
+            if (delta == 0) continue;
+
+            const size_t tier = static_cast<size_t>(CPUTopology::tierOf(processor));
+            for (uint64_t mask = thread.ruleMask; mask; mask &= mask - 1) {
+                const size_t rule = static_cast<size_t>(__builtin_ctzll(mask));
+                window[rule][tier] += delta;
+                total[rule][tier] += delta;
+            }
+        }
+    }
+
+    // One line for a rule: share of one core over the last interval, split
+    // by tier, plus CPU seconds since start; nothing if the rule never ran
+    template <typename Out>
+    void emit(size_t rule, const char* name, Out&& out) const {
+        if (rule >= MAX_RULES) return;
+        unsigned long long sum = 0;
+        for (auto ticks : total[rule]) sum += ticks;
+        if (sum == 0) return;
+
+        const double scale = windowSeconds > 0 ? 100.0 / (windowSeconds * ticksPerSecond) : 0;
+        char line[256];
+        size_t len = std::snprintf(line, sizeof(line), "Util %s:", name);
+        for (size_t tier = 0; tier < TIERS && len < sizeof(line); ++tier) {
+            int n = std::snprintf(line + len, sizeof(line) - len, " %s %.1f%%",
+                                  CPUTopology::TIER_NAMES[tier], window[rule][tier] * scale);
+            if (n < 0) break;
+            len += static_cast<size_t>(n);
+        }
+        if (len < sizeof(line)) {
+            std::snprintf(line + len, sizeof(line) - len, " | %.1fs total",
+                          static_cast<double>(sum) / ticksPerSecond);
+        }
+        out(line);
+    }
+
+    // Per-thread view of the last interval
+    struct Usage {
+        TaskId id;
+        uint64_t ruleMask;
+        bool bound;
+        double percent; // of one core
+    };
+
+    template <typename Fn>
+    void forEachThread(Fn&& fn) const {
+        const double scale = windowSeconds > 0 ? 100.0 / (windowSeconds * ticksPerSecond) : 0;
+        for (const auto& thread : threads) {
+            fn(Usage{thread.id, thread.ruleMask, thread.bound, thread.lastDelta * scale});
+        }
+    }
+
+    template <typename Out>
+    void emitSummary(Out&& out) const {
+        char line[96];
+        std::snprintf(line, sizeof(line), "Util sampler: %zu threads, %zu over fd cap, %.1fs window",
+                      threads.size(), skipped, windowSeconds);
+        out(line);
+    }
+};
+
+// Main optimizer
+class TaskOptimizer {
+private:
+    static constexpr size_t MAX_RULES = 64; // width of ProcessTable::Entry::ruleMask
+
+    struct Rule {
+        std::string pattern;
+        NamePattern matcher;
+        Policy policy;
+        cpu_set_t affinityMask; // resolved once from policy.affinity
+        std::string_view opName;
+        int skippedBound = 0; // affinity skipped on bound threads
+        bool thermalDemotable = false; // RT or perf-pinned: relaxed when hot
+        TokenBucket budget{config::RULE_RATE_PER_SEC, config::RULE_BURST};
+    };
+
+    std::vector<Rule> rules;
+    ProcessTable table;
+    StatsTracker stats;
+    StateSnapshot snapshot;
+    uint64_t matchedRules = 0; // rules that have matched a process, IRQ or workqueue
+    bool thermalDemoted = false;
+    bool dryRun = false; // print planned actions instead of applying them
+    cpu_set_t allCores = CPUTopology::getAllMask();
+    std::vector<ProcessTable::Entry> managed; // scratch for whole-table reapply
+
+    // Global setter budget for the current window
+    std::chrono::steady_clock::time_point budgetWindow = std::chrono::steady_clock::now();
+    int budgetUsed = 0;
+
+    // Threads whose policy was throttled, one entry per task
+    std::unordered_map<TaskId, ProcessTable::Entry, TaskIdHash> deferred;
+    std::vector<ProcessTable::Entry> retry; // scratch for drainDeferred
+    bool retrying = false; // process-wide calls already failed or were paid for
+
+    // Binder pool threads of binderBoost rules, boosted only while busy.
+    // original is the state an unboost returns to.
+    struct BinderThread {
+        ProcessTable::Entry entry;
+        SyscallOptimizer::SchedState original;
+        size_t rule = 0;
+        unsigned long long cpuTime = 0;
+        bool sampled = false;
+        bool boosted = false;
+        int idlePolls = 0;
+    };
+    std::unordered_map<TaskId, BinderThread, TaskIdHash> binderThreads;
+    std::vector<BinderThread*> binderBatch; // scratch for pollBinder
+    std::vector<pid_t> binderBusy; // scratch: tids in a transaction, sorted
+    ProcReader binderReader;
+    int binderBoosted = 0;
+
+    // Only the daemon samples; one-shot passes never create it, as it holds
+    // an open stat fd per tracked thread
+    std::optional<UtilSampler> util;
+
+    // Tier migration state per thread of a migrate rule
+    struct Migration {
+        size_t rule = 0;
+        bool promoted = false;
+        int hotSamples = 0;
+        int coldSamples = 0;
+        std::chrono::steady_clock::time_point moved{};
+    };
+    std::unordered_map<TaskId, Migration, TaskIdHash> migrations;
+    int promotedThreads = 0;
+    int promotions = 0;
+    int demotions = 0;
+    double cpuPressure = -1; // last CPU PSI some avg10, -1 if unavailable
+
+    // Processes of reclaim rules, advised under memory pressure
+    struct Reclaimable {
+        size_t rule = 0;
+        std::chrono::steady_clock::time_point last{};
+    };
+    std::unordered_map<TaskId, Reclaimable, TaskIdHash> reclaimable;
+    double memoryPressure = -1;
+    unsigned long long reclaimedBytes = 0;
+
+    // Hard IRQs handled by irq rules: number -> rule index
+    std::unordered_map<int, size_t> steeredIrqs;
+    std::chrono::steady_clock::time_point nextIrqScan{};
+    int irqFailures = 0;
+
+    // Workqueues tuned by rule: name hash -> rule index. Hashing the
+    // d_name view keeps the per-scan lookup free of string allocations.
+    std::unordered_map<size_t, size_t> tunedWorkqueues;
+    std::chrono::steady_clock::time_point nextWorkqueueScan{};
+    int workqueueFailures = 0;
+
+    uint64_t matchRules(std::string_view comm) const {
+        uint64_t mask = 0;
+        for (size_t i = 0; i < rules.size(); ++i) {
+            if (rules[i].matcher.matches(comm)) {
+                mask |= uint64_t{1} << i;
+            }
+        }
+        return mask;
+    }
+
+    void record(const Rule& rule, Action action, pid_t tid, int err) {
+        if (err == 0) {
+            stats.recordSuccess(action);
+            return;
+        }
+        stats.recordFailure(action);
+        Logger::logf(true, "Failed %.*s/%s for TID %d: %s",
+                     static_cast<int>(rule.opName.size()), rule.opName.data(),
+                     ACTION_NAMES[static_cast<size_t>(action)], tid, strerror(err));
+    }
+
+    static bool hasAction(const Policy& policy, Action action) {
+        switch (action) {
+            case Action::Nice: return policy.nice != Policy::UNSET;
+            case Action::RT: return policy.rtPriority != Policy::UNSET;
+            case Action::Affinity: return policy.affinity != CPUTopology::CoreSet::None;
+            case Action::IOPrio: return policy.ioClass != Policy::UNSET;
+            case Action::OomAdj: return policy.oomScoreAdj != Policy::UNSET;
+            case Action::MemHigh: return policy.memoryHigh > 0;
+            case Action::IOWeight: return policy.ioWeight > 0;
+            case Action::Reclaim: return policy.reclaim != 0;
+            case Action::Count: break;
+        }
+        return false;
+    }
+
+    bool demoted(const Rule& rule) const { return thermalDemoted && rule.thermalDemotable; }
+
+    // Mask an action applies right now; boosted rules widen to all cores when hot
+    const cpu_set_t& effectiveMask(const Rule& rule) const {
+        return demoted(rule) ? allCores : rule.affinityMask;
+    }
+
+    static int ioprioOf(const Policy& policy) {
+        return SyscallOptimizer::makeIOPrio(policy.ioClass, policy.ioLevel);
+    }
+
+    int applyAction(const Rule& rule, Action action, pid_t tid) const {
+        const Policy& policy = rule.policy;
+        switch (action) {
+            case Action::Nice: return SyscallOptimizer::setNice(tid, policy.nice);
+            case Action::RT:
+                if (demoted(rule)) {
+                    return SyscallOptimizer::setNormal(
+                        tid, policy.nice != Policy::UNSET ? policy.nice : config::THERMAL_DEMOTED_NICE);
+                }
+                return SyscallOptimizer::setRT(tid, policy.rtPriority);
+            case Action::Affinity: return SyscallOptimizer::setAffinity(tid, effectiveMask(rule));
+            case Action::IOPrio: return SyscallOptimizer::setIOPrio(tid, ioprioOf(policy));
+            case Action::OomAdj: return MemoryPolicy::setOomScoreAdj(tid, policy.oomScoreAdj);
+            case Action::MemHigh: return MemoryPolicy::setMemoryHigh(tid, policy.memoryHigh);
+            case Action::IOWeight: return OwnCgroup::setIOWeight(tid, policy.ioWeight);
+            case Action::Reclaim:
+            case Action::Count: break;
+        }
+        return EINVAL;
+    }
+
+    // Applies an action to a whole thread group in one call; returns
+    // false when no process-wide primitive is usable so the caller
+    // falls back to per-thread setters. SCHED_FIFO has none.
+    bool applyGroupAction(const Rule& rule, Action action, const ProcessTable::Entry& leader) {
+        const Policy& policy = rule.policy;
+        switch (action) {
+            case Action::Nice:
+                return table.isSoleGroupLeader(leader.tid, leader.pgid) &&
+                       SyscallOptimizer::setNiceGroup(leader.pgid, policy.nice) == 0;
+            case Action::IOPrio:
+                return table.isSoleGroupLeader(leader.tid, leader.pgid) &&
+                       SyscallOptimizer::setIOPrioGroup(leader.pgid, ioprioOf(policy)) == 0;
+            case Action::Affinity:
+                return config::COALESCE_CPUSET &&
+                       CpusetGroups::attachProcess(leader.tid, effectiveMask(rule)) == 0;
+            default:
+                return false;
+        }
+    }
+
+    // applyAction / applyGroupAction wrapped in a trace slice named after
+    // the action and target, followed by an errno counter sample
+    template <typename Apply>
+    int traced(const Rule& rule, Action action, const char* target, pid_t id, Apply apply) {
+        if (!Tracer::enabled()) return apply();
+
+        const char* actionName = ACTION_NAMES[static_cast<size_t>(action)];
+        char name[64];
+        std::snprintf(name, sizeof(name), "%s %s=%d", actionName, target, id);
+        const uint64_t start = Tracer::begin(name);
+        const int err = apply();
+
+        char ruleName[128];
+        char args[192];
+        std::snprintf(args, sizeof(args), "\"%s\":%d,\"errno\":%d,\"rule\":\"%s\"", target, id, err,
+                      Tracer::escape(ruleName, sizeof(ruleName), rule.pattern));
+        Tracer::end(name, start, args);
+        std::snprintf(name, sizeof(name), "%s.errno", actionName);
+        Tracer::counter(name, err);
+        return err;
+    }
+
+    // Feeds the pass latency histogram for the enclosing scope
+    class PassTimer {
+    private:
+        StatsTracker& stats;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    public:
+        explicit PassTimer(StatsTracker& tracker) : stats(tracker) {}
+        ~PassTimer() {
+            stats.recordPass(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+        PassTimer(const PassTimer&) = delete;
+        PassTimer& operator=(const PassTimer&) = delete;
+    };
+
+    // Dry-run output: one line per action and thread group
+    void planAction(const Rule& rule, Action action, const ProcessTable::Entry& first, size_t n) const {
+        char value[64];
+        const Policy& policy = rule.policy;
+        switch (action) {
+            case Action::Nice: std::snprintf(value, sizeof(value), "%d", policy.nice); break;
+            case Action::RT:
+                if (demoted(rule)) std::snprintf(value, sizeof(value), "normal (thermal)");
+                else std::snprintf(value, sizeof(value), "fifo %d", policy.rtPriority);
+                break;
+            case Action::Affinity: CPUTopology::formatMask(effectiveMask(rule), value, sizeof(value)); break;
+            case Action::IOPrio: SyscallOptimizer::formatIOPrio(ioprioOf(policy), value, sizeof(value)); break;
+            case Action::OomAdj: std::snprintf(value, sizeof(value), "%d", policy.oomScoreAdj); break;
+            case Action::MemHigh: std::snprintf(value, sizeof(value), "%lld bytes", policy.memoryHigh); break;
+            case Action::IOWeight: std::snprintf(value, sizeof(value), "%d", policy.ioWeight); break;
+            case Action::Reclaim:
+                std::snprintf(value, sizeof(value), "%s under pressure",
+                              policy.reclaim == MADV_PAGEOUT ? "pageout" : "cold");
+                break;
+            case Action::Count: value[0] = '\0'; break;
+        }
+        std::printf("would set %-8s %-16s tgid %-6d %3zu threads -> %s  [%s]\n",
+                    ACTION_NAMES[static_cast<size_t>(action)], first.comm, first.tgid, n, value,
+                    rule.pattern.c_str());
+    }
+
+    static bool isBinderThread(const char* comm) {
+        return std::strncmp(comm, "binder:", 7) == 0 || std::strncmp(comm, "HwBinder:", 9) == 0;
+    }
+
+    // Binder threads of a binderBoost rule are left to pollBinder
+    bool binderManaged(const Rule& rule, const ProcessTable::Entry& entry) const {
+        return rule.policy.binderBoost && isBinderThread(entry.comm);
+    }
+
+    // "some avg10" of a PSI file, or -1 when PSI is unavailable
+    static double readPressure(const char* path) {
+        char buf[256];
+        if (ProcessUtils::readFile(path, buf, sizeof(buf)) <= 0) return -1;
+        const char* avg = std::strstr(buf, "some avg10=");
+        return avg ? std::strtod(avg + 11, nullptr) : -1;
+    }
+
+    // cpuset when available, since a coalesced process's cpuset would
+    // otherwise clamp the new affinity; plain affinity as fallback
+    static int moveThread(pid_t tid, const cpu_set_t& mask) {
+        if (config::COALESCE_CPUSET && CpusetGroups::attachThread(tid, mask) == 0) return 0;
+        return SyscallOptimizer::setAffinity(tid, mask);
+    }
+
+    // Promotes starving threads of migrate rules to all cores and demotes
+    // them back once idle, with hysteresis on both sides plus a dwell time
+    void migrateTiers() {
+        cpuPressure = readPressure(config::CPU_PRESSURE);
+        const bool pressured = cpuPressure < 0 || cpuPressure >= config::TIER_PROMOTE_PSI;
+        const auto now = std::chrono::steady_clock::now();
+        const auto dwell = std::chrono::milliseconds(config::TIER_MIN_DWELL_MS);
+
+        util->forEachThread([&](const UtilSampler::Usage& usage) {
+            if (usage.bound) return;
+            size_t ruleIndex = MAX_RULES;
+            for (uint64_t mask = usage.ruleMask; mask; mask &= mask - 1) {
+                const size_t i = static_cast<size_t>(__builtin_ctzll(mask));
+                if (i < rules.size() && rules[i].policy.migrate) {
+                    ruleIndex = i;
+                    break;
+                }
+            }
+            if (ruleIndex == MAX_RULES) return;
+            Rule& rule = rules[ruleIndex];
+            if (CPU_EQUAL(&rule.affinityMask, &allCores) || CPU_COUNT(&allCores) == 0) return;
+
+            Migration& state = migrations[usage.id];
+            state.rule = ruleIndex;
+            const bool hot = pressured && usage.percent >= config::TIER_PROMOTE_UTIL;
+            const bool cold = usage.percent <= config::TIER_DEMOTE_UTIL;
+            state.hotSamples = hot ? state.hotSamples + 1 : 0;
+            state.coldSamples = cold ? state.coldSamples + 1 : 0;
+            if (now - state.moved < dwell) return;
+
+            const bool promote = !state.promoted && state.hotSamples >= config::TIER_PROMOTE_SAMPLES;
+            const bool demote = state.promoted && state.coldSamples >= config::TIER_DEMOTE_SAMPLES;
+            if ((!promote && !demote) || !admit(rule)) return;
+
+            const int err = moveThread(usage.id.tid, promote ? allCores : rule.affinityMask);
+            record(rule, Action::Affinity, usage.id.tid, err);
+            if (err) return;
+
+            state.promoted = promote;
+            state.moved = now;
+            state.hotSamples = state.coldSamples = 0;
+            promotedThreads += promote ? 1 : -1;
+            ++(promote ? promotions : demotions);
+            Logger::logf(false, "Migration: %s TID %d (%.0f%% cpu, psi %.1f)",
+                         promote ? "promoted" : "demoted", usage.id.tid, usage.percent, cpuPressure);
+        });
+    }
+
+    // Exited threads leave; renamed ones were just reapplied to their home cores
+    void forgetMigrations(const ProcessTable::Diff& diff) {
+        if (migrations.empty()) return;
+        for (const auto* list : {&diff.exited, &diff.renamed}) {
+            for (const auto& entry : *list) {
+                auto it = migrations.find(entry.id());
+                if (it == migrations.end()) continue;
+                if (it->second.promoted) --promotedThreads;
+                migrations.erase(it);
+            }
+        }
+    }
+
+    // Points hard IRQs whose action names match an irq rule at the rule's
+    // cores, the ones its threaded handler irq/<n>-<name> gets as well.
+    // Polled, since drivers request IRQs as they probe. Each IRQ is written
+    // once per rule, failed or not: per-CPU and managed IRQs never accept one.
+    void steerIrqs() {
+        const auto now = std::chrono::steady_clock::now();
+        if (now < nextIrqScan) return;
+        nextIrqScan = now + std::chrono::milliseconds(config::IRQ_POLL_MS);
+        auto steers = [](const Rule& rule) {
+            return rule.policy.irq && rule.policy.affinity != CPUTopology::CoreSet::None &&
+                   CPU_COUNT(&rule.affinityMask) > 0;
+        };
+        if (std::none_of(rules.begin(), rules.end(), steers)) return;
+
+        Tracer::Scope pass("irq");
+        Interrupts::forEach([&](int irq, const char* names) {
+            size_t match = rules.size();
+            for (size_t i = 0; i < rules.size() && match == rules.size(); ++i) {
+                const Rule& rule = rules[i];
+                if (!steers(rule)) continue;
+                for (const char* name = names; *name;) {
+                    const size_t len = std::strcspn(name, ",");
+                    if (rule.matcher.matches(std::string_view(name, len))) {
+                        match = i;
+                        break;
+                    }
+                    name += len;
+                    while (*name == ',' || *name == ' ') ++name;
+                }
+            }
+            if (match == rules.size()) return;
+            matchedRules |= uint64_t{1} << match;
+            auto it = steeredIrqs.find(irq);
+            if (it != steeredIrqs.end() && it->second == match) return;
+
+            Rule& rule = rules[match];
+            char cpus[64];
+            CPUTopology::formatMask(rule.affinityMask, cpus, sizeof(cpus));
+            if (dryRun) {
+                std::printf("would set irq      %-16.16s irq  %-6d             -> %s  [%s]\n",
+                            names, irq, cpus, rule.pattern.c_str());
+            } else {
+                if (!admit(rule)) return; // next poll
+                // Original affinity goes to disk before it is changed
+                const bool captured = snapshot.captureIrq(irq);
+                saveSnapshot();
+                const int err = Interrupts::setAffinity(irq, rule.affinityMask);
+                if (err && captured) {
+                    snapshot.forgetIrq(irq);
+                    saveSnapshot();
+                }
+                if (err) {
+                    ++irqFailures;
+                    Logger::logf(true, "Failed irq affinity for IRQ %d (%s): %s", irq, names, strerror(err));
+                } else {
+                    Logger::logf(false, "IRQ %d (%s) -> cpus %s", irq, names, cpus);
+                }
+            }
+            steeredIrqs[irq] = match;
+        });
+    }
+
+    // Sets nice and cpumask of unbound workqueues matched by name against
+    // the rules. Per-tid settings on kworkers are lost whenever the pool
+    // replaces a worker; the workqueue attributes cover every future one.
+    // Each workqueue is written once per rule, like IRQs.
+    void tuneWorkqueues() {
+        const auto now = std::chrono::steady_clock::now();
+        if (now < nextWorkqueueScan) return;
+        nextWorkqueueScan = now + std::chrono::milliseconds(config::WORKQUEUE_POLL_MS);
+        auto tunes = [](const Rule& rule) {
+            return rule.policy.nice != Policy::UNSET || CPU_COUNT(&rule.affinityMask) > 0;
+        };
+        if (std::none_of(rules.begin(), rules.end(), tunes)) return;
+
+        Tracer::Scope pass("workqueue");
+        Workqueues::forEach([&](const char* name) {
+            size_t match = 0;
+            while (match < rules.size() && !(tunes(rules[match]) && rules[match].matcher.matches(name))) {
+                ++match;
+            }
+            if (match == rules.size()) return;
+            // Workqueue names (kblockd, writeback) are what some rules target
+            matchedRules |= uint64_t{1} << match;
+            const size_t key = std::hash<std::string_view>()(name);
+            auto it = tunedWorkqueues.find(key);
+            if (it != tunedWorkqueues.end() && it->second == match) return;
+
+            Rule& rule = rules[match];
+            const Policy& policy = rule.policy;
+            char cpus[64];
+            CPUTopology::formatMask(rule.affinityMask, cpus, sizeof(cpus));
+            if (dryRun) {
+                char nice[12];
+                std::snprintf(nice, sizeof(nice), "%d", policy.nice);
+                std::printf("would set wq       %-16.16s nice %-6s             -> %s  [%s]\n", name,
+                            policy.nice == Policy::UNSET ? "-" : nice, cpus, rule.pattern.c_str());
+            } else {
+                if (!admit(rule)) return; // next poll
+                // Original attributes go to disk first; without them it is left alone
+                int err = snapshot.captureWorkqueue(name) ? 0 : EIO;
+                if (!err) saveSnapshot();
+                if (!err && policy.nice != Policy::UNSET) err = Workqueues::setNice(name, policy.nice);
+                if (!err && CPU_COUNT(&rule.affinityMask)) err = Workqueues::setCpumask(name, rule.affinityMask);
+                if (err) {
+                    ++workqueueFailures;
+                    Logger::logf(true, "Failed workqueue %s: %s", name, strerror(err));
+                } else {
+                    Logger::logf(false, "Workqueue %s -> nice %d, cpus %s", name,
+                                 policy.nice == Policy::UNSET ? 0 : policy.nice, cpus);
+                }
+            }
+            tunedWorkqueues[key] = match;
+        });
+    }
+
+    // Renamed processes are re-registered by applyEntries if still matched
+    void forgetReclaimable(const ProcessTable::Diff& diff) {
+        if (reclaimable.empty()) return;
+        for (const auto* list : {&diff.exited, &diff.renamed}) {
+            for (const auto& entry : *list) {
+                if (entry.tid == entry.tgid) reclaimable.erase(entry.id());
+            }
+        }
+    }
+
+    // Rules whose process-wide controls the snapshot has to save first;
+    // reclaim hints are not undoable and not included
+    uint64_t processControlRules() const {
+        uint64_t mask = 0;
+        for (size_t i = 0; i < rules.size(); ++i) {
+            const Policy& policy = rules[i].policy;
+            if (hasAction(policy, Action::OomAdj) || hasAction(policy, Action::MemHigh) ||
+                hasAction(policy, Action::IOWeight)) {
+                mask |= uint64_t{1} << i;
+            }
+        }
+        return mask;
+    }
+
+    void saveSnapshot() {
+        if (int err = snapshot.save()) Logger::logf(true, "Failed to save snapshot: %s", strerror(err));
+    }
+
+    // Charges one setter call to the rule and the global budget
+    bool admit(Rule& rule) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now - budgetWindow >= std::chrono::milliseconds(config::BUDGET_WINDOW_MS)) {
+            budgetWindow = now;
+            budgetUsed = 0;
+        }
+        if (budgetUsed >= config::SYSCALL_BUDGET || !rule.budget.take(now)) return false;
+        ++budgetUsed;
+        return true;
+    }
+
+    // Queues a throttled block; a task queued twice is kept once
+    void defer(const ProcessTable::Entry* entries, size_t n) {
+        for (size_t k = 0; k < n; ++k) deferred[entries[k].id()] = entries[k];
+        stats.recordThrottled(static_cast<int>(n));
+    }
+
+    static constexpr uint32_t ALL_ACTIONS = (1u << static_cast<size_t>(Action::Count)) - 1;
+
+    static constexpr uint32_t actionBit(Action action) {
+        return 1u << static_cast<size_t>(action);
+    }
+
+    // entries[0..n) share a tgid. When entries[0] is the leader the block
+    // holds the whole thread group and is eligible for coalescing.
+    // Only actions in the actions bitmask are applied.
+    void applyBlock(const ProcessTable::Entry* entries, size_t n, uint32_t actions = ALL_ACTIONS,
+                    bool demotableOnly = false) {
+        const auto& first = entries[0];
+        const bool wholeGroup = !retrying && first.tid == first.tgid &&
+                                n >= config::COALESCE_MIN_THREADS;
+        const bool anyBound = std::any_of(entries, entries + n,
+                                          [](const auto& entry) { return entry.bound; });
+
+        // Actions each rule still needs per thread after process-wide calls
+        uint32_t pending[MAX_RULES] = {};
+        for (size_t i = 0; i < rules.size(); ++i) {
+            if (!(first.ruleMask & (uint64_t{1} << i))) continue;
+            Rule& rule = rules[i];
+            if (demotableOnly && !rule.thermalDemotable) continue;
+            if (Tracer::enabled()) Tracer::counter("rule.match", static_cast<long long>(i));
+
+            for (size_t a = 0; a < static_cast<size_t>(Action::Count); ++a) {
+                const auto action = static_cast<Action>(a);
+                if (!(actions & actionBit(action)) || !hasAction(rule.policy, action)) continue;
+                // Process actions go through the leader once, never per thread
+                const bool processWide = isProcessAction(action);
+                if (processWide && (first.tid != first.tgid || first.kthread)) continue;
+                if (dryRun) {
+                    // Binder threads are left to pollBinder, so they would not be set here
+                    const size_t targets = processWide ? n : static_cast<size_t>(std::count_if(
+                        entries, entries + n, [&](const auto& entry) { return !binderManaged(rule, entry); }));
+                    if (targets) planAction(rule, action, first, targets);
+                    continue;
+                }
+                if (action == Action::Reclaim) {
+                    reclaimable.try_emplace(first.id(), Reclaimable{i, {}});
+                    continue;
+                }
+                if (processWide) {
+                    if (!admit(rule)) {
+                        defer(entries, n);
+                        return;
+                    }
+                    record(rule, action, first.tid, traced(rule, action, "tgid", first.tid, [&] {
+                        return applyAction(rule, action, first.tid);
+                    }));
+                    continue;
+                }
+
+                const bool affinity = action == Action::Affinity;
+                if (wholeGroup && !(affinity && anyBound) && !rule.policy.binderBoost) {
+                    if (!admit(rule)) {
+                        defer(entries, n);
+                        return;
+                    }
+                    if (traced(rule, action, "tgid", first.tid, [&] {
+                            return applyGroupAction(rule, action, first) ? 0 : ENOTSUP;
+                        }) == 0) {
+                        stats.recordSuccess(action, static_cast<int>(n));
+                        stats.recordCoalesced(static_cast<int>(n));
+                        continue;
+                    }
+                }
+                pending[i] |= actionBit(action);
+            }
+        }
 
-    TaskOptimizer optimizer;
+        // Thread by thread, so running out of budget defers only the
+        // threads not yet done. Setters are idempotent, so a thread cut
+        // off halfway simply gets all of its actions again later.
+        for (size_t k = 0; k < n; ++k) {
+            const pid_t tid = entries[k].tid;
+            for (size_t i = 0; i < rules.size(); ++i) {
+                if (!pending[i]) continue;
+                Rule& rule = rules[i];
+                if (binderManaged(rule, entries[k])) continue;
+
+                for (size_t a = 0; a < static_cast<size_t>(Action::Count); ++a) {
+                    const auto action = static_cast<Action>(a);
+                    if (!(pending[i] & actionBit(action))) continue;
+                    if (action == Action::Affinity && entries[k].bound) {
+                        ++rule.skippedBound;
+                        continue;
+                    }
+                    if (!admit(rule)) {
+                        defer(entries + k, n - k);
+                        return;
+                    }
+                    record(rule, action, tid, traced(rule, action, "tid", tid, [&] {
+                        return applyAction(rule, action, tid);
+                    }));
+                }
+            }
+        }
+    }
+
+    void applyDelta(const ProcessTable::Diff& diff) {
+        for (const auto& entry : diff.appeared) matchedRules |= entry.ruleMask;
+        for (const auto& entry : diff.renamed) matchedRules |= entry.ruleMask;
+
+        // Original state goes to disk before anything is changed
+        if (!dryRun) {
+            snapshot.forget(diff.exited);
+            const uint64_t processRules = processControlRules();
+            snapshot.capture(diff.appeared, processRules);
+            snapshot.capture(diff.renamed, processRules);
+            saveSnapshot();
+        }
+        forgetReclaimable(diff);
+        untrackBinderThreads(diff);
+        applyEntries(diff.appeared);
+        applyEntries(diff.renamed);
+        trackBinderThreads(diff);
+        forgetMigrations(diff);
+        if (util) util->track(diff);
+    }
+
+    // Runs before the diff is applied. Drops binder threads that exited
+    // or left their rule; live ones that were boosted go back to defaults,
+    // so whatever rule now matches starts from there. Threads renamed
+    // within their rule keep their boost state.
+    void untrackBinderThreads(const ProcessTable::Diff& diff) {
+        for (const auto* list : {&diff.exited, &diff.renamed}) {
+            for (const auto& entry : *list) {
+                auto it = binderThreads.find(entry.id());
+                if (it == binderThreads.end()) continue;
+                BinderThread& thread = it->second;
+                const Rule& rule = rules[thread.rule];
+                if (list == &diff.renamed && (entry.ruleMask & (uint64_t{1} << thread.rule)) &&
+                    binderManaged(rule, entry)) {
+                    thread.entry = entry;
+                    continue;
+                }
+                if (thread.boosted && entry.id().alive()) setBinderBoost(thread, false);
+                if (thread.boosted) --binderBoosted; // gone, or unboost was throttled
+                binderThreads.erase(it);
+            }
+        }
+    }
+
+    // Runs after the diff is applied; starts tracking new binder threads
+    void trackBinderThreads(const ProcessTable::Diff& diff) {
+        for (const auto* list : {&diff.appeared, &diff.renamed}) {
+            for (const auto& entry : *list) {
+                if (binderThreads.count(entry.id())) continue;
+                for (size_t i = 0; i < rules.size(); ++i) {
+                    if (!(entry.ruleMask & (uint64_t{1} << i)) || !binderManaged(rules[i], entry)) continue;
+                    BinderThread thread;
+                    thread.entry = entry;
+                    thread.rule = i;
+                    // The snapshot has it from before any process-wide tuning
+                    if (!snapshot.lookup(entry.id(), thread.original) &&
+                        SyscallOptimizer::getState(entry.tid, thread.original) != 0) {
+                        thread.original = SyscallOptimizer::SchedState{};
+                        thread.original.affinity = allCores;
+                    }
+                    binderThreads.emplace(entry.id(), thread);
+                    break;
+                }
+            }
+        }
+    }
+
+    // Tids with a transaction in flight, from the binder debug state file.
+    // Returns false when the file is not readable.
+    bool readBinderTransactions() {
+        static char text[65536];
+        int fd = open(config::BINDER_STATE, O_RDONLY | O_CLOEXEC);
+        if (fd < 0 && errno == ENOENT) fd = open(config::BINDER_STATE_DEBUGFS, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+
+        // "proc <pid>" opens a process, "  thread <tid>: ..." a thread, and
+        // indented "... transaction ..." lines below it mean it is busy
+        binderBusy.clear();
+        pid_t proc = 0;
+        pid_t thread = 0;
+        auto parseLine = [&](const char* line) {
+            if (std::strncmp(line, "proc ", 5) == 0) {
+                proc = static_cast<pid_t>(std::strtol(line + 5, nullptr, 10));
+                thread = 0;
+            } else if (std::strncmp(line, "  thread ", 9) == 0) {
+                thread = static_cast<pid_t>(std::strtol(line + 9, nullptr, 10));
+            } else if (thread && proc && std::strncmp(line, "    ", 4) == 0 &&
+                       std::strstr(line, "transaction")) {
+                binderBusy.push_back(thread);
+                thread = 0;
+            }
+        };
+
+        // With many processes the file outgrows any fixed buffer, so it is
+        // parsed a chunk at a time; a partial last line carries over
+        size_t len = 0;
+        ssize_t n;
+        while ((n = read(fd, text + len, sizeof(text) - 1 - len)) > 0) {
+            len += static_cast<size_t>(n);
+            char* line = text;
+            while (char* newline = static_cast<char*>(std::memchr(line, '\n', text + len - line))) {
+                *newline = '\0';
+                parseLine(line);
+                line = newline + 1;
+            }
+            len -= static_cast<size_t>(line - text);
+            if (len == sizeof(text) - 1) len = 0; // one line filling the buffer; no binder line is that long
+            std::memmove(text, line, len);
+        }
+        close(fd);
+        text[len] = '\0';
+        if (len) parseLine(text);
+
+        std::sort(binderBusy.begin(), binderBusy.end());
+        return true;
+    }
+
+    bool inTransaction(pid_t tid) const {
+        return std::binary_search(binderBusy.begin(), binderBusy.end(), tid);
+    }
+
+    // Boost applies the rule's policy; unboost puts back the thread's
+    // state from before it was first boosted
+    void setBinderBoost(BinderThread& thread, bool boost) {
+        Rule& rule = rules[thread.rule];
+        const auto& entry = thread.entry;
+        for (size_t a = 0; a < static_cast<size_t>(Action::Count); ++a) {
+            const auto action = static_cast<Action>(a);
+            if (!hasAction(rule.policy, action) || isProcessAction(action)) continue;
+            const auto& original = thread.original;
+            if (action == Action::Affinity && (entry.bound || (!boost && CPU_COUNT(&original.affinity) == 0))) continue;
+            if (!admit(rule)) return; // retried on the next poll
+
+            int err = 0;
+            if (boost) {
+                err = applyAction(rule, action, entry.tid);
+            } else {
+                switch (action) {
+                    case Action::Nice: err = SyscallOptimizer::setNice(entry.tid, original.nice); break;
+                    case Action::RT:
+                        err = SyscallOptimizer::setPolicy(entry.tid, original.policy,
+                                                          original.rtPriority, original.nice);
+                        break;
+                    case Action::Affinity: err = SyscallOptimizer::setAffinity(entry.tid, original.affinity); break;
+                    case Action::IOPrio: err = SyscallOptimizer::setIOPrio(entry.tid, original.ioprio); break;
+                    default: break;
+                }
+            }
+            record(rule, action, entry.tid, err);
+        }
+        if (thread.boosted != boost) binderBoosted += boost ? 1 : -1;
+        thread.boosted = boost;
+    }
+
+    void applyEntries(const std::vector<ProcessTable::Entry>& entries,
+                      uint32_t actions = ALL_ACTIONS, bool demotableOnly = false) {
+        for (size_t begin = 0; begin < entries.size();) {
+            size_t end = begin + 1;
+            while (end < entries.size() && entries[end].tgid == entries[begin].tgid) ++end;
+            applyBlock(&entries[begin], end - begin, actions, demotableOnly);
+            begin = end;
+        }
+    }
+
+public:
+    void addRule(std::string_view pattern, const Policy& policy, std::string_view opName) {
+        if (!Sanitizer::isValidPattern(pattern)) {
+            Logger::log("Invalid pattern: " + std::string(pattern), true);
+            return;
+        }
+        if (rules.size() >= MAX_RULES) {
+            Logger::log("Rule limit reached, ignoring: " + std::string(pattern), true);
+            return;
+        }
+        Rule rule{std::string(pattern), NamePattern(pattern), policy,
+                  CPUTopology::getMask(policy.affinity, policy.minCapacity), opName};
+        bool perfPinned = policy.affinity == CPUTopology::CoreSet::Perf;
+
+        // Expressions compile here, against the topology read at startup
+        if (policy.affinity == CPUTopology::CoreSet::Expr) {
+            if (!CPUTopology::parseMask(policy.affinityExpr, rule.affinityMask)) {
+                Logger::logf(true, "Invalid affinity expression for %s: %s",
+                             rule.pattern.c_str(), policy.affinityExpr);
+                return;
+            }
+            if (CPU_COUNT(&rule.affinityMask) == 0) {
+                Logger::logf(true, "Affinity %s of %s selects no CPUs here, affinity not set",
+                             policy.affinityExpr, rule.pattern.c_str());
+                rule.policy.affinity = CPUTopology::CoreSet::None;
+            } else {
+                const cpu_set_t perf = CPUTopology::getPerfMask();
+                cpu_set_t inPerf;
+                CPU_AND(&inPerf, &rule.affinityMask, &perf);
+                perfPinned = CPU_EQUAL(&inPerf, &rule.affinityMask);
+            }
+        }
+        rule.thermalDemotable = policy.rtPriority != Policy::UNSET || perfPinned;
+        rules.push_back(std::move(rule));
+    }
+
+    // Scans /proc and applies rules to tasks that appeared or were renamed
+    // since the previous scan. Returns the delta that was processed.
+    const ProcessTable::Diff& rescan() {
+        Tracer::Scope pass("rescan");
+        PassTimer timer(stats);
+        const auto& diff = [this]() -> const ProcessTable::Diff& {
+            Tracer::Scope scan("scan");
+            return table.rescan([this](std::string_view comm) { return matchRules(comm); });
+        }();
+
+        {
+            Tracer::Scope apply("apply");
+            drainDeferred();
+            applyDelta(diff);
+            steerIrqs();
+            tuneWorkqueues();
+        }
+        Tracer::flush();
+        return diff;
+    }
+
+    size_t deferredCount() const { return deferred.size(); }
+
+    size_t binderThreadCount() const { return binderThreads.size(); }
+
+    // Samples always, so util stays current; migrates only when asked,
+    // which the daemon does not while paused
+    void sampleUtilization(bool migrate) {
+        if (!util) return;
+        Tracer::Scope pass("util");
+        util->sample();
+        if (migrate && !dryRun) migrateTiers();
+    }
+
+    // Advises the processes of reclaim rules while memory PSI is at least
+    // RECLAIM_PSI, each at most once per RECLAIM_INTERVAL_MS. Without PSI
+    // there is no pressure signal, so nothing is reclaimed.
+    void reclaimMemory() {
+        if (reclaimable.empty() || dryRun) return;
+        memoryPressure = readPressure(config::MEMORY_PRESSURE);
+        if (memoryPressure < config::RECLAIM_PSI) return;
+
+        Tracer::Scope pass("reclaim");
+        const auto now = std::chrono::steady_clock::now();
+        const auto interval = std::chrono::milliseconds(config::RECLAIM_INTERVAL_MS);
+        for (auto it = reclaimable.begin(); it != reclaimable.end();) {
+            const TaskId id = it->first;
+            Reclaimable& target = it->second;
+            Rule& rule = rules[target.rule];
+            if (target.last != std::chrono::steady_clock::time_point{} && now - target.last < interval) {
+                ++it;
+                continue;
+            }
+            if (!admit(rule)) break; // the rest wait for the next pass
+            target.last = now;
+
+            size_t advised = 0;
+            const int err = traced(rule, Action::Reclaim, "tgid", id.tid, [&] {
+                return MemoryPolicy::reclaim(id, rule.policy.reclaim, advised);
+            });
+            record(rule, Action::Reclaim, id.tid, err);
+            reclaimedBytes += advised;
+            // Gone, or a permanent refusal that would fail every interval
+            if (err && err != EAGAIN && err != EINTR) it = reclaimable.erase(it);
+            else ++it;
+        }
+    }
+
+    // Samples binder pool threads and boosts the busy ones: in a
+    // transaction per the binder state file when readable, else running
+    // or burning CPU since the last poll. Idle threads drop back after
+    // BINDER_IDLE_POLLS quiet polls so short gaps don't cause flapping.
+    void pollBinder() {
+        if (binderThreads.empty() || dryRun) return;
+        Tracer::Scope pass("binder");
+        const bool haveTransactions = readBinderTransactions();
+
+        binderBatch.clear();
+        for (auto& [id, thread] : binderThreads) binderBatch.push_back(&thread);
+
+        for (size_t base = 0; base < binderBatch.size(); base += ProcReader::BATCH) {
+            const size_t n = std::min(ProcReader::BATCH, binderBatch.size() - base);
+            for (size_t i = 0; i < n; ++i) {
+                const auto& entry = binderBatch[base + i]->entry;
+                std::snprintf(binderReader.path(i), ProcReader::PATH_SIZE, "/proc/%d/task/%d/stat",
+                              entry.tgid, entry.tid);
+            }
+            binderReader.readAll(n);
+
+            for (size_t i = 0; i < n; ++i) {
+                BinderThread& thread = *binderBatch[base + i];
+                ProcessUtils::ProcStat st;
+                if (binderReader.result(i) <= 0 || !ProcessUtils::parseStat(binderReader.buffer(i), st) ||
+                    st.startTime != thread.entry.startTime) {
+                    continue; // exited; the next rescan drops it
+                }
+
+                const bool ran = thread.sampled && st.cpuTime - thread.cpuTime >= config::BINDER_ACTIVE_TICKS;
+                thread.cpuTime = st.cpuTime;
+                thread.sampled = true;
+                const bool busy = haveTransactions ? inTransaction(thread.entry.tid)
+                                                   : st.state == 'R' || ran;
+
+                thread.idlePolls = busy ? 0 : thread.idlePolls + 1;
+                if (busy && !thread.boosted) {
+                    setBinderBoost(thread, true);
+                } else if (thread.boosted && thread.idlePolls >= config::BINDER_IDLE_POLLS) {
+                    setBinderBoost(thread, false);
+                }
+            }
+        }
+        if (Tracer::enabled()) Tracer::counter("binder.boosted", binderBoosted);
+    }
+
+    // Retries throttled threads that are still the same task and still
+    // managed, with their current rule mask. Retries go thread by thread
+    // so each attempt makes progress instead of re-paying for group calls.
+    void drainDeferred() {
+        if (deferred.empty()) return;
+        retry.clear();
+        for (const auto& [id, entry] : deferred) {
+            const ProcessTable::Entry* current = table.lookup(id);
+            if (current && current->ruleMask) retry.push_back(*current);
+        }
+        deferred.clear();
+        std::sort(retry.begin(), retry.end(), [](const auto& a, const auto& b) {
+            if (a.tgid != b.tgid) return a.tgid < b.tgid;
+            if ((a.tid == a.tgid) != (b.tid == b.tgid)) return a.tid == a.tgid;
+            return a.tid < b.tid;
+        });
+        Tracer::Scope pass("deferred");
+        retrying = true;
+        applyEntries(retry);
+        retrying = false;
+    }
+
+    // Builds the table and records matches without applying anything
+    void scan() {
+        const auto& diff = table.rescan([this](std::string_view comm) { return matchRules(comm); });
+        for (const auto& entry : diff.appeared) matchedRules |= entry.ruleMask;
+    }
+
+    void setDryRun(bool enabled) { dryRun = enabled; }
+
+    // Starts per-rule utilization sampling; call before the first rescan
+    void enableSampling() {
+        if (!util) util.emplace();
+    }
+
+    // Drops all rules and forgets matches, so the next rescan applies a
+    // freshly loaded rule set to every task. Boosts, promotions and IRQ and
+    // workqueue tuning are undone first: the new rules may not redo them,
+    // and their bookkeeping is gone after this. Not budgeted, it is one-off.
+    void clearRules() {
+        int undone = 0;
+        int failed = 0;
+        auto tally = [&](int err) { ++(err ? failed : undone); };
+        for (const auto& [id, thread] : binderThreads) {
+            if (thread.boosted && id.alive()) tally(SyscallOptimizer::setState(id.tid, thread.original));
+        }
+        for (const auto& [id, state] : migrations) {
+            if (state.promoted && id.alive()) tally(moveThread(id.tid, rules[state.rule].affinityMask));
+        }
+        int restored = 0;
+        if (!steeredIrqs.empty()) {
+            failed += snapshot.restoreIrqs(restored);
+            undone += restored;
+        }
+        if (!tunedWorkqueues.empty()) {
+            failed += snapshot.restoreWorkqueues(restored);
+            undone += restored;
+        }
+        if (undone || failed) Logger::logf(false, "Undid %d tunings of the old rules, %d failed", undone, failed);
+
+        rules.clear();
+        matchedRules = 0;
+        deferred.clear();
+        binderThreads.clear();
+        binderBoosted = 0;
+        if (util) util->clear();
+        migrations.clear();
+        promotedThreads = 0;
+        reclaimable.clear();
+        steeredIrqs.clear();
+        nextIrqScan = {};
+        tunedWorkqueues.clear();
+        nextWorkqueueScan = {};
+        table.reset();
+    }
+
+    // Calls out(line) per rule: pattern, source and policy
+    template <typename Out>
+    void emitRules(Out&& out) const {
+        static constexpr const char* CORE_SETS[] = {"-", "perf", "eff", "all", "energy", "expr"};
+        auto field = [](char* buf, size_t size, int value) {
+            if (value == Policy::UNSET) std::snprintf(buf, size, "-");
+            else std::snprintf(buf, size, "%d", value);
+            return buf;
+        };
+        char line[320];
+        char nice[12];
+        char rt[12];
+        char io[12];
+        char oom[12];
+        for (size_t i = 0; i < rules.size(); ++i) {
+            const Rule& rule = rules[i];
+            const Policy& policy = rule.policy;
+            const char* reclaim = policy.reclaim == MADV_PAGEOUT ? "pageout"
+                                  : policy.reclaim == MADV_COLD ? "cold" : "-";
+            std::snprintf(line, sizeof(line),
+                          "%s [%.*s] nice=%s rt=%s io=%s affinity=%s binder=%d migrate=%d "
+                          "oom=%s memhigh=%lld ioweight=%d reclaim=%s irq=%d matched=%s",
+                          rule.pattern.c_str(), static_cast<int>(rule.opName.size()), rule.opName.data(),
+                          field(nice, sizeof(nice), policy.nice), field(rt, sizeof(rt), policy.rtPriority),
+                          policy.ioClass == Policy::UNSET
+                              ? "-" : SyscallOptimizer::formatIOPrio(ioprioOf(policy), io, sizeof(io)),
+                          policy.affinity == CPUTopology::CoreSet::Expr
+                              ? policy.affinityExpr : CORE_SETS[static_cast<size_t>(policy.affinity)],
+                          policy.binderBoost, policy.migrate, field(oom, sizeof(oom), policy.oomScoreAdj),
+                          policy.memoryHigh, policy.ioWeight, reclaim, policy.irq,
+                          matchedRules & (uint64_t{1} << i) ? "yes" : "no");
+            out(line);
+        }
+    }
+
+    template <typename Out>
+    void emitStats(Out&& out) const {
+        stats.emit(out);
+        char line[128];
+        std::snprintf(line, sizeof(line), "Tracked: %zu | Deferred: %zu", table.size(), deferred.size());
+        out(line);
+        std::snprintf(line, sizeof(line), "Binder threads: %zu tracked, %d boosted",
+                      binderThreads.size(), binderBoosted);
+        out(line);
+        std::snprintf(line, sizeof(line), "Tier migration: %d promoted, %d promotions, %d demotions, psi %.1f",
+                      promotedThreads, promotions, demotions, cpuPressure);
+        out(line);
+        std::snprintf(line, sizeof(line), "Reclaim: %zu processes, %llu MiB advised, psi %.1f",
+                      reclaimable.size(), reclaimedBytes >> 20, memoryPressure);
+        out(line);
+        std::snprintf(line, sizeof(line), "IRQs: %zu steered, %d failed",
+                      steeredIrqs.size() - static_cast<size_t>(irqFailures), irqFailures);
+        out(line);
+        std::snprintf(line, sizeof(line), "Workqueues: %zu tuned, %d failed",
+                      tunedWorkqueues.size() - static_cast<size_t>(workqueueFailures), workqueueFailures);
+        out(line);
+        emitUtil(out);
+    }
+
+    // Per-rule CPU use from the sampler
+    template <typename Out>
+    void emitUtil(Out&& out) const {
+        if (!util) return;
+        util->emitSummary(out);
+        for (size_t i = 0; i < rules.size(); ++i) util->emit(i, rules[i].pattern.c_str(), out);
+    }
+
+    template <typename Out>
+    void emitHistogram(Out&& out) const { stats.emitHistogram(out); }
+
+    // Calls fn(entry, pattern) for every managed thread, grouped by process;
+    // pattern is the first rule the process matched
+    template <typename Fn>
+    void forEachManaged(Fn&& fn) {
+        table.collectManaged(managed);
+        for (const auto& entry : managed) {
+            const size_t rule = static_cast<size_t>(__builtin_ctzll(entry.ruleMask));
+            fn(entry, std::string_view(rules[rule].pattern));
+        }
+    }
+
+    // Loads this boot's snapshot so already-tuned threads keep their
+    // original state on record across daemon restarts
+    void loadSnapshot() {
+        if (snapshot.load()) Logger::logf(false, "Snapshot: %zu threads on record", snapshot.size());
+    }
+
+    // Reverts every thread in this boot's snapshot; returns false on failures
+    bool restoreSnapshot() {
+        if (!snapshot.load()) {
+            Logger::log("No snapshot for this boot, nothing to restore");
+            return true;
+        }
+        int restored = 0;
+        const int failed = snapshot.restore(restored);
+        Logger::logf(false, "Restored %d of %zu recorded threads, %d failed",
+                     restored, snapshot.size(), failed);
+        const int irqFailed = snapshot.restoreIrqs(restored);
+        if (snapshot.irqCount()) {
+            Logger::logf(false, "Restored %d of %zu recorded IRQs, %d failed",
+                         restored, snapshot.irqCount(), irqFailed);
+        }
+        const int workqueueFailed = snapshot.restoreWorkqueues(restored);
+        if (snapshot.workqueueCount()) {
+            Logger::logf(false, "Restored %d of %zu recorded workqueues, %d failed",
+                         restored, snapshot.workqueueCount(), workqueueFailed);
+        }
+        return failed == 0 && irqFailed == 0 && workqueueFailed == 0;
+    }
+
+    // Re-evaluates only the given thread-group leaders
+    const ProcessTable::Diff& refresh(const std::vector<pid_t>& tgids) {
+        Tracer::Scope pass("refresh");
+        PassTimer timer(stats);
+        const auto& diff = table.refresh(tgids.data(), tgids.size(), [this](std::string_view comm) {
+            return matchRules(comm);
+        });
+        applyDelta(diff);
+        Tracer::flush();
+        return diff;
+    }
+
+    // Widens boosted tasks to all cores and relaxes RT to CFS while hot;
+    // restores their policy once cooled. Only affected actions are reissued.
+    void setThermalDemoted(bool demote) {
+        if (demote == thermalDemoted) return;
+        thermalDemoted = demote;
+        table.collectManaged(managed);
+        Tracer::Scope pass(demote ? "thermal.demote" : "thermal.restore");
+        applyEntries(managed, actionBit(Action::Affinity) | actionBit(Action::RT), true);
+        for (auto& [id, thread] : binderThreads) {
+            if (thread.boosted && rules[thread.rule].thermalDemotable) setBinderBoost(thread, true);
+        }
+        Tracer::flush();
+    }
+
+    bool isThermalDemoted() const { return thermalDemoted; }
+
+    // Rules early start waits for. irq rules are left out: each names one
+    // vendor's driver, so most never show up on a given device, and the
+    // daemon keeps polling for their IRQs anyway.
+    bool allRulesMatched() const {
+        uint64_t waited = 0;
+        for (size_t i = 0; i < rules.size(); ++i) {
+            if (!rules[i].policy.irq) waited |= uint64_t{1} << i;
+        }
+        return (matchedRules & waited) == waited;
+    }
+
+    // Logs rules that have not matched any process so far
+    void reportUnmatched() {
+        for (size_t i = 0; i < rules.size(); ++i) {
+            if (!(matchedRules & (uint64_t{1} << i))) {
+                Logger::logf(false, "No processes found for: %s", rules[i].pattern.c_str());
+            }
+        }
+    }
+
+    size_t managedTasks() const { return table.size(); }
+
+    void reportKernelThreads() {
+        if (table.kernelThreadsIndexed()) {
+            Logger::logf(false, "Kernel thread index: %zu kthreadd children",
+                         table.kernelThreadCount());
+        } else {
+            Logger::log("Kernel thread index unavailable, classifying kthreads by stat");
+        }
+    }
+
+    void reportStats() {
+        stats.report();
+        emitUtil([](const char* line) { Logger::log(line); });
+        for (const auto& rule : rules) {
+            if (rule.skippedBound == 0) continue;
+            Logger::logf(false, "%s: affinity skipped (bound) on %d threads",
+                         rule.pattern.c_str(), rule.skippedBound);
+        }
+    }
+};
+
+bool bootCompleted() {
+#if TASK_OPTIMIZER_HAS_PROPERTIES
+    char value[PROP_VALUE_MAX] = {};
+    return __system_property_get("sys.boot_completed", value) > 0 && std::strcmp(value, "1") == 0;
+#else
+    return false;
+#endif
+}
+
+// Early-boot phase: tunes each target as soon as it execs or is renamed,
+// until every rule has matched, boot completes or the deadline passes.
+// Rules for processes this device never runs would otherwise hold the
+// phase open until the deadline; once boot is done, late starters are
+// left to the daemon's regular rescans.
+void waitForTargets(TaskOptimizer& optimizer) {
+    using clock = std::chrono::steady_clock;
+    const auto deadline = clock::now() + std::chrono::milliseconds(config::EARLY_START_DEADLINE_MS);
+    auto nextFullScan = clock::now() + std::chrono::milliseconds(config::EARLY_START_RESCAN_MS);
+
+    ProcEvents events;
+    std::vector<pid_t> tgids;
+    while (!optimizer.allRulesMatched()) {
+        const auto now = clock::now();
+        if (now >= deadline) {
+            Logger::log("Early start deadline reached");
+            return;
+        }
+        if (bootCompleted()) {
+            Logger::log("Boot completed, ending early start");
+            return;
+        }
+
+        const auto wake = std::min(deadline, nextFullScan);
+        const int timeoutMs = static_cast<int>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count());
+
+        bool overflow = events.wait(std::max(timeoutMs, 1), tgids);
+        if (!tgids.empty()) optimizer.refresh(tgids);
+
+        // Threads spawned after exec are picked up by periodic full scans
+        if (overflow || clock::now() >= nextFullScan) {
+            optimizer.rescan();
+            nextFullScan = clock::now() + std::chrono::milliseconds(config::EARLY_START_RESCAN_MS);
+        }
+    }
+    Logger::log("All targets tuned");
+}
+
+void addDefaultRules(TaskOptimizer& optimizer) {
+    Policy highPrio;
+    highPrio.nice = -10;
+    highPrio.affinity = CPUTopology::CoreSet::Perf;
+    highPrio.ioClass = SyscallOptimizer::IOPRIO_CLASS_BE;
+    highPrio.ioLevel = config::HIGH_PRIO_IO_LEVEL;
+
+    Policy realTime;
+    realTime.rtPriority = 50;
+    realTime.affinity = CPUTopology::CoreSet::Perf;
+    realTime.ioClass = SyscallOptimizer::IOPRIO_CLASS_BE;
+    realTime.ioLevel = 0;
+
+    // Block-layer workers everyone else's I/O waits behind
+    Policy ioRealTime = highPrio;
+    ioRealTime.ioClass = SyscallOptimizer::IOPRIO_CLASS_RT;
+    ioRealTime.ioLevel = config::IO_RT_LEVEL;
+
+    Policy lowPrio;
+    lowPrio.nice = 5;
+    lowPrio.affinity = CPUTopology::CoreSet::Energy;
+    lowPrio.minCapacity = config::LOW_PRIO_MIN_CAPACITY;
+    lowPrio.ioClass = SyscallOptimizer::IOPRIO_CLASS_IDLE;
+    lowPrio.migrate = true;
+
+    Policy binderHighPrio = highPrio;
+    binderHighPrio.binderBoost = true;
+
+    // Same cores as the RT display and touch threads
+    Policy irqPolicy;
+    irqPolicy.affinity = CPUTopology::CoreSet::Perf;
+    irqPolicy.irq = true;
 
-    // High priority system tasks
-    Logger::log("Optimizing high priority tasks...");
     for (const auto& task : config::HIGH_PRIO_TASKS) {
-        optimizer.optimizePattern(task, [](pid_t tid) {
-            return SyscallOptimizer::setNice(tid, -10) &&
-                   SyscallOptimizer::setAffinity(tid, CPUTopology::getPerfMask());
-        }, "high_prio");
+        const bool binder = std::find(config::BINDER_BOOST_TASKS.begin(), config::BINDER_BOOST_TASKS.end(),
+                                      task) != config::BINDER_BOOST_TASKS.end();
+        const bool io = std::find(config::IO_RT_TASKS.begin(), config::IO_RT_TASKS.end(),
+                                  task) != config::IO_RT_TASKS.end();
+        optimizer.addRule(task, binder ? binderHighPrio : io ? ioRealTime : highPrio, "high_prio");
+    }
+    for (const auto& task : config::RT_TASKS) optimizer.addRule(task, realTime, "rt");
+    for (const auto& task : config::LOW_PRIO_TASKS) optimizer.addRule(task, lowPrio, "low_prio");
+    for (const auto& irq : config::IRQ_TASKS) optimizer.addRule(irq, irqPolicy, "irq");
+}
+
+// I/O priority of a rules file: "rt[:level]", "be[:level]", "idle", or a
+// bare class number 0-3 as in earlier versions
+bool parseIOPrio(const char* value, Policy& policy) {
+    static constexpr std::pair<const char*, int> CLASSES[] = {
+        {"none", SyscallOptimizer::IOPRIO_CLASS_NONE}, {"rt", SyscallOptimizer::IOPRIO_CLASS_RT},
+        {"be", SyscallOptimizer::IOPRIO_CLASS_BE}, {"idle", SyscallOptimizer::IOPRIO_CLASS_IDLE},
+    };
+    const size_t len = std::strcspn(value, ":");
+    int ioClass = -1;
+    if (len == 1 && value[0] >= '0' && value[0] <= '3') ioClass = value[0] - '0';
+    for (const auto& [name, id] : CLASSES) {
+        if (std::strlen(name) == len && std::strncmp(value, name, len) == 0) ioClass = id;
+    }
+    if (ioClass < 0) return false;
+
+    int level = 0;
+    if (value[len] == ':') {
+        const bool leveled = ioClass == SyscallOptimizer::IOPRIO_CLASS_RT ||
+                             ioClass == SyscallOptimizer::IOPRIO_CLASS_BE;
+        const char digit = value[len + 1];
+        if (!leveled || digit < '0' || digit >= '0' + SyscallOptimizer::IOPRIO_LEVELS ||
+            value[len + 2] != '\0') {
+            return false;
+        }
+        level = digit - '0';
+    }
+    policy.ioClass = ioClass;
+    policy.ioLevel = level;
+    return true;
+}
+
+// Any other affinity value is a mask expression, checked for syntax here
+// and compiled when the rule is added
+bool parseAffinityExpr(const char* value, Policy& policy) {
+    cpu_set_t mask;
+    if (std::strlen(value) >= sizeof(policy.affinityExpr) || !CPUTopology::parseMask(value, mask)) {
+        return false;
+    }
+    std::snprintf(policy.affinityExpr, sizeof(policy.affinityExpr), "%s", value);
+    policy.affinity = CPUTopology::CoreSet::Expr;
+    return true;
+}
+
+// Rules file: one rule per line, "<pattern> key=value...", '#' comments.
+// Keys: nice, rt, io (class[:level], see parseIOPrio), affinity
+// (perf|eff|all|energy or a mask expression, see CPUTopology::parseMask),
+// mincap, binder (1: boost binder pool threads only while busy), migrate
+// (1: let starving threads widen to all cores), oom (oom_score_adj),
+// memhigh (cgroup v2 memory.high, K/M/G suffixes), ioweight (cgroup v2
+// io.bfq.weight or io.weight, 1-1000), reclaim (cold|pageout), irq (1:
+// also steer hard IRQs whose names match to the rule's affinity).
+// Returns the number of rules added, or -1 if the file can't be read.
+int loadRules(TaskOptimizer& optimizer, const char* path) {
+    static char text[16384];
+    if (ProcessUtils::readFile(path, text, sizeof(text)) < 0) {
+        Logger::logf(true, "Cannot read rules file %s: %s", path, strerror(errno));
+        return -1;
     }
 
-    // Real-time tasks
-    Logger::log("Optimizing real-time tasks...");
-    for (const auto& task : config::RT_TASKS) {
-        optimizer.optimizePattern(task, [](pid_t tid) {
-            return SyscallOptimizer::setRT(tid, 50) &&
-                   SyscallOptimizer::setAffinity(tid, CPUTopology::getPerfMask());
-        }, "rt");
+    int added = 0;
+    int lineNo = 0;
+    char* save = nullptr;
+    for (char* line = strtok_r(text, "\n", &save); line; line = strtok_r(nullptr, "\n", &save)) {
+        ++lineNo;
+        if (char* comment = std::strchr(line, '#')) *comment = '\0';
+
+        char* fieldSave = nullptr;
+        const char* pattern = strtok_r(line, " \t\r", &fieldSave);
+        if (!pattern) continue;
+
+        Policy policy;
+        bool valid = true;
+        for (char* field = strtok_r(nullptr, " \t\r", &fieldSave); field && valid;
+             field = strtok_r(nullptr, " \t\r", &fieldSave)) {
+            char* value = std::strchr(field, '=');
+            if (!value) {
+                valid = false;
+                break;
+            }
+            *value++ = '\0';
+
+            char* end = nullptr;
+            const long number = std::strtol(value, &end, 10);
+            const bool numeric = end != value && *end == '\0';
+            if (std::strcmp(field, "affinity") == 0) {
+                if (std::strcmp(value, "perf") == 0) policy.affinity = CPUTopology::CoreSet::Perf;
+                else if (std::strcmp(value, "eff") == 0) policy.affinity = CPUTopology::CoreSet::Eff;
+                else if (std::strcmp(value, "all") == 0) policy.affinity = CPUTopology::CoreSet::All;
+                else if (std::strcmp(value, "energy") == 0) policy.affinity = CPUTopology::CoreSet::Energy;
+                else valid = parseAffinityExpr(value, policy);
+            } else if (std::strcmp(field, "io") == 0) {
+                valid = parseIOPrio(value, policy);
+            } else if (std::strcmp(field, "reclaim") == 0) {
+                if (std::strcmp(value, "cold") == 0) policy.reclaim = MADV_COLD;
+                else if (std::strcmp(value, "pageout") == 0) policy.reclaim = MADV_PAGEOUT;
+                else valid = false;
+            } else if (std::strcmp(field, "memhigh") == 0) {
+                const int shift = *end == 'K' ? 10 : *end == 'M' ? 20 : *end == 'G' ? 30 : 0;
+                valid = end != value && number > 0 && (shift ? end[1] == '\0' : *end == '\0');
+                policy.memoryHigh = static_cast<long long>(number) << shift;
+            } else if (!numeric) {
+                valid = false;
+            } else if (std::strcmp(field, "nice") == 0 && number >= -20 && number <= 19) {
+                policy.nice = static_cast<int>(number);
+            } else if (std::strcmp(field, "rt") == 0 && number >= 1 && number <= 99) {
+                policy.rtPriority = static_cast<int>(number);
+            } else if (std::strcmp(field, "mincap") == 0 && number >= 0 && number <= 1024) {
+                policy.minCapacity = static_cast<int>(number);
+            } else if (std::strcmp(field, "binder") == 0 && (number == 0 || number == 1)) {
+                policy.binderBoost = number == 1;
+            } else if (std::strcmp(field, "migrate") == 0 && (number == 0 || number == 1)) {
+                policy.migrate = number == 1;
+            } else if (std::strcmp(field, "irq") == 0 && (number == 0 || number == 1)) {
+                policy.irq = number == 1;
+            } else if (std::strcmp(field, "oom") == 0 && number >= -1000 && number <= 1000) {
+                policy.oomScoreAdj = static_cast<int>(number);
+            } else if (std::strcmp(field, "ioweight") == 0 && number >= 1 && number <= 1000) {
+                policy.ioWeight = static_cast<int>(number);
+            } else {
+                valid = false;
+            }
+        }
+
+        if (!valid) {
+            Logger::logf(true, "%s:%d: invalid rule, skipped", path, lineNo);
+            continue;
+        }
+        optimizer.addRule(pattern, policy, "rules_file");
+        ++added;
     }
+    return added;
+}
 
-    // Low priority tasks
-    Logger::log("Optimizing low priority tasks...");
-    for (const auto& task : config::LOW_PRIO_TASKS) {
-        optimizer.optimizePattern(task, [](pid_t tid) {
-            return SyscallOptimizer::setNice(tid, 5) &&
-                   SyscallOptimizer::setAffinity(tid, CPUTopology::getEffMask()) &&
-                   SyscallOptimizer::setIOPrio(tid, 3);
-        }, "low_prio");
+// Rules from RULES_FILE when it exists and yields any, else the built-in lists
+void loadConfiguredRules(TaskOptimizer& optimizer) {
+    if (access(config::RULES_FILE, R_OK) == 0) {
+        const int added = loadRules(optimizer, config::RULES_FILE);
+        if (added > 0) {
+            Logger::logf(false, "Loaded %d rules from %s", added, config::RULES_FILE);
+            return;
+        }
     }
+    addDefaultRules(optimizer);
+}
+
+// With firstScanOnly, returns after the first full scan (--startup-probe)
+void optimizeSystem(TaskOptimizer& optimizer, bool firstScanOnly = false) {
+    Logger::log("=== Starting Advanced System Optimization ===");
+    CPUTopology::logTopology();
+    loadConfiguredRules(optimizer);
+    optimizer.loadSnapshot();
+
+    Logger::log("Scanning processes and applying rules...");
+    optimizer.rescan();
+    optimizer.reportKernelThreads();
+    if (firstScanOnly) return;
+    waitForTargets(optimizer);
+    optimizer.reportUnmatched();
 
     optimizer.reportStats();
     Logger::log("=== System Optimization Completed ===");
 }
 
-int main() {
+// Keeps the process table warm and only touches tasks that changed.
+// Thermal state is sampled between rescans and on trip-point uevents;
+// control socket requests are served from the same poll loop.
+[[noreturn]] void runDaemon(TaskOptimizer& optimizer) {
+    using clock = std::chrono::steady_clock;
+    ThermalMonitor thermal;
+    ControlServer control;
+    auto nextRescan = clock::now() + std::chrono::milliseconds(config::RESCAN_INTERVAL_MS);
+    auto nextThermal = clock::now();
+    auto nextDeferred = clock::now();
+    auto nextBinder = clock::now();
+    auto nextUtil = clock::now() + std::chrono::milliseconds(config::UTIL_SAMPLE_MS);
+    bool paused = false;
+
+    // Read-only queries are answered from a reply formatted at most once
+    // per CONTROL_SNAPSHOT_MS, so a burst of clients costs a copy each
+    constexpr std::array<std::string_view, 5> READ_ONLY = {"stats", "histogram", "rules", "util",
+                                                           "managed"};
+    static std::array<ControlServer::Reply, READ_ONLY.size()> snapshots;
+    std::array<clock::time_point, READ_ONLY.size()> snapshotAt{};
+
+    auto query = [&](std::string_view command, ControlServer::Reply& reply) {
+        auto out = [&reply](const char* line) { reply.line("%s", line); };
+        if (command == "stats") {
+            reply.line("State: %s%s", paused ? "paused" : "running",
+                       thermal.isHot() ? ", thermal demotion" : "");
+            optimizer.emitStats(out);
+        } else if (command == "histogram") {
+            optimizer.emitHistogram(out);
+        } else if (command == "rules") {
+            optimizer.emitRules(out);
+        } else if (command == "util") {
+            optimizer.emitUtil(out);
+        } else if (command == "managed") {
+            reply.line("%zu", optimizer.managedTasks());
+        }
+    };
+
+    auto handle = [&](std::string_view command, ControlServer::Reply& reply) {
+        for (size_t i = 0; i < READ_ONLY.size(); ++i) {
+            if (command != READ_ONLY[i]) continue;
+            const auto now = clock::now();
+            if (snapshotAt[i] == clock::time_point{} ||
+                now - snapshotAt[i] >= std::chrono::milliseconds(config::CONTROL_SNAPSHOT_MS)) {
+                snapshots[i].len = 0;
+                query(command, snapshots[i]);
+                snapshotAt[i] = now;
+            }
+            reply = snapshots[i];
+            return;
+        }
+
+        // Anything else changes state, which later queries should show
+        snapshotAt.fill(clock::time_point{});
+        if (command == "pause" || command == "resume") {
+            paused = command == "pause";
+            Logger::log(paused ? "Paused by control request" : "Resumed by control request");
+            reply.line("ok");
+        } else if (command == "rescan") {
+            nextRescan = clock::now();
+            reply.line("ok");
+        } else if (command == "reload") {
+            optimizer.clearRules();
+            loadConfiguredRules(optimizer);
+            nextRescan = clock::now();
+            Logger::log("Rules reloaded by control request");
+            reply.line("ok");
+        } else {
+            reply.line("unknown command; try stats, histogram, rules, util, managed, "
+                       "pause, resume, rescan, reload");
+        }
+    };
+
+    for (;;) {
+        auto now = clock::now();
+        auto wake = thermal.available() ? std::min(nextRescan, nextThermal) : nextRescan;
+        if (optimizer.deferredCount() && !paused) wake = std::min(wake, nextDeferred);
+        if (optimizer.binderThreadCount() && !paused) wake = std::min(wake, nextBinder);
+        wake = std::min({wake, nextUtil, control.nextDeadline()});
+        const int timeoutMs = static_cast<int>(std::max<long long>(
+            0, std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count()));
+
+        pollfd fds[1 + ControlServer::POLL_FDS];
+        fds[0] = pollfd{thermal.fd(), POLLIN, 0};
+        control.pollSet(fds + 1);
+        bool tripped = false;
+        if (poll(fds, 1 + ControlServer::POLL_FDS, timeoutMs) > 0 && (fds[0].revents & POLLIN)) {
+            tripped = thermal.tripped();
+        }
+        control.serve(fds + 1, handle);
+        now = clock::now();
+
+        if (thermal.available() && (tripped || now >= nextThermal)) {
+            nextThermal = now + std::chrono::milliseconds(config::THERMAL_POLL_MS);
+            thermal.update();
+        }
+        // Compared every tick rather than acted on per flip, so a flip seen
+        // while paused still takes effect on resume
+        if (thermal.available() && !paused && thermal.isHot() != optimizer.isThermalDemoted()) {
+            Logger::logf(false, "Thermal: %.1fC, %s boosted tasks",
+                         thermal.temperature() / 1000.0,
+                         thermal.isHot() ? "demoting" : "restoring");
+            optimizer.setThermalDemoted(thermal.isHot());
+        }
+
+        if (optimizer.deferredCount() && !paused && now >= nextDeferred) {
+            nextDeferred = now + std::chrono::milliseconds(config::DEFERRED_RETRY_MS);
+            optimizer.drainDeferred();
+        }
+
+        if (now >= nextUtil) {
+            nextUtil = now + std::chrono::milliseconds(config::UTIL_SAMPLE_MS);
+            optimizer.sampleUtilization(!paused);
+            if (!paused) optimizer.reclaimMemory();
+        }
+
+        if (optimizer.binderThreadCount() && !paused && now >= nextBinder) {
+            nextBinder = now + std::chrono::milliseconds(config::BINDER_POLL_MS);
+            optimizer.pollBinder();
+        }
+
+        if (now < nextRescan) continue;
+        nextRescan = now + std::chrono::milliseconds(config::RESCAN_INTERVAL_MS);
+        if (paused) continue;
+
+        const auto& diff = optimizer.rescan();
+        nextDeferred = clock::now() + std::chrono::milliseconds(config::DEFERRED_RETRY_MS);
+        if (diff.empty()) continue;
+
+        Logger::logf(false, "Rescan: %zu appeared, %zu renamed, %zu exited | Tracked: %zu",
+                     diff.appeared.size(), diff.renamed.size(), diff.exited.size(),
+                     optimizer.managedTasks());
+        optimizer.reportStats();
+    }
+}
+
+// scan: prints every matched thread with its current scheduling state
+int cmdScan() {
+    TaskOptimizer optimizer;
+    loadConfiguredRules(optimizer);
+    optimizer.scan();
+
+    std::printf("%-7s %-7s %-16s %-5s %-6s %-6s %-12s %s\n",
+                "TID", "TGID", "COMM", "NICE", "POLICY", "IOPRIO", "CPUS", "RULE");
+    optimizer.forEachManaged([](const ProcessTable::Entry& entry, std::string_view rule) {
+        SyscallOptimizer::SchedState state;
+        if (SyscallOptimizer::getState(entry.tid, state) != 0) return;
+
+        char policy[16];
+        if (state.policy == SCHED_FIFO || state.policy == SCHED_RR) {
+            std::snprintf(policy, sizeof(policy), "%s%d", state.policy == SCHED_FIFO ? "ff" : "rr",
+                          state.rtPriority);
+        } else {
+            std::snprintf(policy, sizeof(policy), "%s", state.policy == SCHED_BATCH ? "batch"
+                          : state.policy == SCHED_IDLE ? "idle" : "other");
+        }
+        char cpus[64];
+        char io[16];
+        std::printf("%-7d %-7d %-16s %-5d %-6s %-6s %-12s %.*s%s\n",
+                    entry.tid, entry.tgid, entry.comm, state.nice, policy,
+                    SyscallOptimizer::formatIOPrio(state.ioprio, io, sizeof(io)),
+                    CPUTopology::formatMask(state.affinity, cpus, sizeof(cpus)),
+                    static_cast<int>(rule.size()), rule.data(), entry.bound ? " (bound)" : "");
+    });
+    return 0;
+}
+
+// apply: a single scan-and-apply pass without the daemon
+int cmdApply(const char* rulesFile, bool dryRun) {
+    TaskOptimizer optimizer;
+    if (rulesFile) {
+        if (loadRules(optimizer, rulesFile) < 0) return 1;
+    } else {
+        loadConfiguredRules(optimizer);
+    }
+    optimizer.setDryRun(dryRun);
+    optimizer.loadSnapshot();
+    optimizer.rescan();
+    optimizer.reportUnmatched();
+    if (!dryRun) optimizer.reportStats();
+    return 0;
+}
+
+// ctl: sends one control command to the running daemon
+int cmdControl(const char* command) {
+    static char reply[8192];
+    if (int err = ControlServer::query(command, reply, sizeof(reply))) {
+        std::fprintf(stderr, "task_optimizer daemon not reachable: %s\n", strerror(err));
+        return 1;
+    }
+    std::fputs(reply, stdout);
+    return 0;
+}
+
+// bench: times each stage of a pass against the live /proc
+int cmdBench() {
+    auto nowUs = [] {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    };
+    auto report = [](const char* stage, std::vector<long long>& samples) {
+        std::sort(samples.begin(), samples.end());
+        std::printf("%-14s %5zu %10lld %10lld %10lld\n", stage, samples.size(),
+                    samples.front(), samples[samples.size() / 2], samples.back());
+    };
+    std::printf("%-14s %5s %10s %10s %10s\n", "stage (us)", "runs", "min", "median", "max");
+
+    std::vector<long long> samples;
+    for (int i = 0; i < 5; ++i) {
+        const long long start = nowUs();
+        TaskOptimizer optimizer;
+        addDefaultRules(optimizer);
+        samples.push_back(nowUs() - start);
+    }
+    report("setup", samples);
+
+    samples.clear();
+    for (int i = 0; i < 5; ++i) {
+        TaskOptimizer optimizer;
+        addDefaultRules(optimizer);
+        const long long start = nowUs();
+        optimizer.scan();
+        samples.push_back(nowUs() - start);
+    }
+    report("cold scan", samples);
+
+    TaskOptimizer optimizer;
+    addDefaultRules(optimizer);
+    optimizer.scan();
+    samples.clear();
+    for (int i = 0; i < 20; ++i) {
+        const long long start = nowUs();
+        optimizer.scan();
+        samples.push_back(nowUs() - start);
+    }
+    report("warm rescan", samples);
+
+    samples.clear();
+    size_t threads = 0;
+    for (int i = 0; i < 20; ++i) {
+        threads = 0;
+        const long long start = nowUs();
+        optimizer.forEachManaged([&](const ProcessTable::Entry& entry, std::string_view) {
+            SyscallOptimizer::SchedState state;
+            SyscallOptimizer::getState(entry.tid, state);
+            ++threads;
+        });
+        samples.push_back(nowUs() - start);
+    }
+    report("state read", samples);
+    std::printf("managed threads: %zu\n", threads);
+    return 0;
+}
+
+// restore: reverts every thread tuned this boot to its recorded state
+int cmdRestore() {
+    TaskOptimizer optimizer;
+    return optimizer.restoreSnapshot() ? 0 : 1;
+}
+
+int usage() {
+    std::fprintf(stderr,
+                 "Usage: task_optimizer [command]\n"
+                 "  daemon                           tune targets and keep running (default)\n"
+                 "  scan                             list matched threads and their current policy\n"
+                 "  apply [--rules FILE] [--dry-run] run a single tuning pass\n"
+                 "  status                           show the running daemon's stats\n"
+                 "  ctl COMMAND                      send stats, histogram, rules, util, managed, pause,\n"
+                 "                                   resume, rescan or reload to the daemon\n"
+                 "  bench                            time scan and apply stages\n"
+                 "  restore                          revert threads tuned this boot to their original state\n"
+                 "  --startup-probe                  run daemon startup up to its first full scan as a\n"
+                 "                                   dry run, then exit (used by bench_startup)\n"
+                 "  help                             show this message\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
     try {
-        std::error_code ec;
-        fs::create_directories(config::LOG_DIR, ec);
-        if (ec) {
-            std::cerr << "Failed to create log directory: " << ec.message() << '\n';
+        const std::string_view command = argc > 1 ? argv[1] : "daemon";
+        // Touches nothing but stderr
+        if (command == "help" || command == "--help") {
+            usage();
+            return 0;
+        }
+
+        const int err = ProcessUtils::makeDirs(config::LOG_DIR);
+        if (err && command == "daemon") {
+            std::fprintf(stderr, "Failed to create log directory: %s\n", strerror(err));
             return 1;
         }
 
-        optimizeSystem();
-        return 0;
+        if (command == "scan") return cmdScan();
+        if (command == "status") return cmdControl("stats");
+        if (command == "ctl") return argc == 3 ? cmdControl(argv[2]) : usage();
+        if (command == "bench") return cmdBench();
+        if (command == "apply") {
+            const char* rulesFile = nullptr;
+            bool dryRun = false;
+            for (int i = 2; i < argc; ++i) {
+                const std::string_view arg = argv[i];
+                if (arg == "--dry-run") dryRun = true;
+                else if (arg == "--rules" && i + 1 < argc) rulesFile = argv[++i];
+                else return usage();
+            }
+            Logger::setEcho(true);
+            return cmdApply(rulesFile, dryRun);
+        }
+        if (command == "restore") {
+            Logger::setEcho(true);
+            return cmdRestore();
+        }
+        const bool probe = command == "--startup-probe";
+        if (command != "daemon" && !probe) return usage();
+
+        Tracer::init();
+        TaskOptimizer optimizer;
+        optimizer.setDryRun(probe);
+        if (!probe) optimizer.enableSampling();
+        optimizeSystem(optimizer, probe);
+        if (probe) return 0;
+        runDaemon(optimizer);
 
     } catch (const std::exception& e) {
         Logger::log("Critical error: " + std::string(e.what()), true);
@@ -1,5 +1,14 @@
 #!/system/bin/sh
 
+# Module root dir
+MODDIR="${0%/*}"
+
+# Revert threads tuned this boot to their original scheduling state. The
+# snapshot is tied to the boot it was taken in, so this only does anything
+# when the module is removed without rebooting first; after a reboot nothing
+# is tuned and there is nothing to revert.
+[ -x "$MODDIR/bin/task_optimizer" ] && "$MODDIR/bin/task_optimizer" restore >/dev/null 2>&1
+
 # Don't modify anything after this
 if [ -f $INFO ]; then
   while read LINE; do